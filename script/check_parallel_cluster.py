@@ -0,0 +1,98 @@
+from sys import argv
+import filecmp
+import os
+import random
+import shutil
+import subprocess
+import tempfile
+
+# checks that huge clusters expanded with --parallel_cluster_size give the same
+# output with one thread and with many threads, and the same as without it
+# usage: python check_parallel_cluster.py <vm-core> [thread_num]
+
+vm_core = argv[1]
+thread_num = int(argv[2]) if len(argv) > 2 else 8
+
+bases = 'ACGT'
+header = '##fileformat=VCFv4.1\n' \
+         '##FORMAT=<ID=GT,Number=1,Type=String,Description="Genotype">\n' \
+         '#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tSAMPLE\n'
+
+def other_base(b):
+    return random.choice([x for x in bases if x != b])
+
+# a dinucleotide repeat holds deletions that can be placed on any repeat unit,
+# so many paths of a cluster end with the same score, small clusters between the
+# repeats are matched before them
+def make_data(directory):
+    random.seed(17)
+    sequence = ''
+    baseline = []
+    query = []
+    for r in range(6):
+        sequence += ''.join(random.choice(bases) for _ in range(300))
+        for snp in (len(sequence), len(sequence) + 3):
+            sequence += ''.join(random.choice(bases) for _ in range(3))
+            alt = other_base(sequence[snp])
+            baseline.append((snp, sequence[snp], alt, '0/1'))
+            query.append((snp, sequence[snp], alt, random.choice(['0/1', '1/1'])))
+        sequence += ''.join(random.choice(bases) for _ in range(300))
+        repeat_start = len(sequence)
+        sequence += 'CA' * 24
+        for k in range(5):
+            pos = repeat_start + 8 * k
+            baseline.append((pos, sequence[pos:pos+3], sequence[pos], random.choice(['0/1', '1/1'])))
+            shifted = pos + 2 * random.randint(0, 1)
+            query.append((shifted, sequence[shifted:shifted+3], sequence[shifted], random.choice(['0/1', '1/1'])))
+            snp = pos + 5
+            alt = other_base(sequence[snp])
+            baseline.append((snp, sequence[snp], alt, '0/1'))
+            if random.random() < 0.7:
+                query.append((snp, sequence[snp], alt, random.choice(['0/1', '1/1'])))
+    sequence += ''.join(random.choice(bases) for _ in range(300))
+    with open(os.path.join(directory, 'genome.fa'), 'w') as f:
+        f.write('>chr1\n')
+        for i in range(0, len(sequence), 60):
+            f.write(sequence[i:i+60] + '\n')
+    for name, variants in (('baseline.vcf', baseline), ('query.vcf', query)):
+        with open(os.path.join(directory, name), 'w') as f:
+            f.write(header)
+            written = set()
+            for pos, ref, alt, gt in sorted(variants):
+                if pos in written:
+                    continue
+                written.add(pos)
+                f.write('chr1\t%d\t.\t%s\t%s\t30\tPASS\t.\tGT\t%s\n' % (pos + 1, ref, alt, gt))
+
+def run(directory, name, options):
+    output_dir = os.path.join(directory, name)
+    os.mkdir(output_dir)
+    with open(os.devnull, 'w') as devnull:
+        subprocess.check_call([vm_core,
+                               '-g', os.path.join(directory, 'genome.fa'),
+                               '-b', os.path.join(directory, 'baseline.vcf'),
+                               '-q', os.path.join(directory, 'query.vcf'),
+                               '-o', output_dir] + options, stdout=devnull)
+    return output_dir
+
+def same_output(expected_dir, output_dir, description):
+    names = sorted(os.listdir(expected_dir))
+    match, mismatch, errors = filecmp.cmpfiles(expected_dir, output_dir, names, shallow=False)
+    if mismatch or errors or sorted(os.listdir(output_dir)) != names:
+        print('output differs ' + description + ': ' + ' '.join(mismatch + errors))
+        return False
+    return True
+
+directory = tempfile.mkdtemp()
+try:
+    make_data(directory)
+    plain_dir = run(directory, 'plain', ['-t', str(thread_num)])
+    single_dir = run(directory, 't1', ['-t', '1', '--parallel_cluster_size', '4'])
+    multi_dir = run(directory, 't' + str(thread_num), ['-t', str(thread_num), '--parallel_cluster_size', '4'])
+    if not same_output(single_dir, multi_dir, 'between -t 1 and -t ' + str(thread_num)):
+        exit(1)
+    if not same_output(plain_dir, multi_dir, 'with and without --parallel_cluster_size'):
+        exit(1)
+    print('identical output for ' + str(len(os.listdir(plain_dir))) + ' files')
+finally:
+    shutil.rmtree(directory)
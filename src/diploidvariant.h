@@ -34,6 +34,7 @@ public:
     bool flag; //in DiploidVariant, flag = false is reference, flag = true is query
     // keep flag as int? not necessary
     double qual;
+    vector<vector<string> > alt_vectors; // alts aligned to ref, one string per reference base
 
 //    int get_pos() const{return pos};
 //    string get_ref() const{return ref};
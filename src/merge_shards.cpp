@@ -0,0 +1,217 @@
+#include <tclap/CmdLine.h>
+#include <map>
+#include <dirent.h>
+#include <algorithm>
+#include <iostream>
+#include "util.h"
+
+using namespace std;
+
+// combines outputs of vm-core runs with --shard i/N into the output of a single run.
+// .stat rows are summed, .match files are concatenated in shard order
+
+typedef struct Args {
+    vector<string> shard_dirs;
+    string output_dir;
+}Args;
+
+typedef struct ShardStat {
+    string baseline_line;
+    string query_line;
+    int shard_index;
+    int shard_num;
+    string head_line;
+    vector<string> rows;
+}ShardStat;
+
+bool TclapParser(Args & args, int argc, char** argv){
+    string version = "0.9";
+
+    try {
+        std::string desc = "Please cite our paper if you are using this program in your research. \n";
+        TCLAP::CmdLine cmd(desc, ' ', version);
+
+        TCLAP::MultiArg<std::string> arg_shard_dirs("i", "input_dir", "output directory of one shard, give every shard once", true, "dir");
+        TCLAP::ValueArg<std::string> arg_output_dir("o", "output_dir", "output directory of merged results", true, "", "dir");
+
+        cmd.add(arg_shard_dirs);
+        cmd.add(arg_output_dir);
+
+        cmd.parse(argc, argv);
+
+        args.shard_dirs = arg_shard_dirs.getValue();
+        args.output_dir = arg_output_dir.getValue();
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << "\n";
+        abort();
+    }
+    return true;
+}
+
+vector<string> ListFiles(string dir_name){
+    vector<string> file_names;
+    DIR * dir = opendir(dir_name.c_str());
+    if(dir == NULL) return file_names;
+    struct dirent * entry;
+    while((entry = readdir(dir)) != NULL){
+        string file_name = entry->d_name;
+        if(file_name == "." || file_name == "..") continue;
+        file_names.push_back(file_name);
+    }
+    closedir(dir);
+    sort(file_names.begin(), file_names.end());
+    return file_names;
+}
+
+bool EndsWith(const string & s, const string & suffix){
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool ReadShardStat(string filename, ShardStat & shard_stat){
+    ifstream input(filename);
+    if(!input.good()){
+        cout << "[Error] can not read " << filename << endl;
+        return false;
+    }
+    shard_stat.shard_index = -1;
+    shard_stat.shard_num = -1;
+    string line;
+    while(std::getline(input, line).good()){
+        if(line.empty()) continue;
+        if(line.compare(0, 11, "##Baseline:") == 0){
+            shard_stat.baseline_line = line;
+        }else if(line.compare(0, 8, "##Query:") == 0){
+            shard_stat.query_line = line;
+        }else if(line.compare(0, 8, "##Shard:") == 0){
+            vector<string> columns = split(line.substr(8), '/');
+            if(columns.size() == 2){
+                shard_stat.shard_index = stoi(columns[0]);
+                shard_stat.shard_num = stoi(columns[1]);
+            }
+        }else if(line[0] == '#'){
+            shard_stat.head_line = line;
+        }else{
+            shard_stat.rows.push_back(line);
+        }
+    }
+    if(shard_stat.shard_index < 0){
+        cout << "[Error] " << filename << " is not the output of a shard" << endl;
+        return false;
+    }
+    return true;
+}
+
+// match numbers of every threshold are summed, thresholds and query totals are the same in all shards
+bool MergeStatRow(string & merged_row, const string & row){
+    vector<string> merged_columns = split(merged_row, '\t');
+    vector<string> columns = split(row, '\t');
+    if(merged_columns.size() != columns.size() || columns.size() < 7) return false;
+    for(int i = 0; i < 4; i++){
+        if(merged_columns[i] != columns[i]) return false;
+    }
+    for(int i = 4; i <= 5; i++){
+        vector<string> merged_nums = split(merged_columns[i], ',');
+        vector<string> nums = split(columns[i], ',');
+        if(merged_nums.size() != nums.size()) return false;
+        string sum_string = "";
+        for(int k = 0; k < nums.size(); k++){
+            sum_string += to_string(stoi(merged_nums[k]) + stoi(nums[k]));
+            if(k < nums.size() - 1) sum_string += ",";
+        }
+        merged_columns[i] = sum_string;
+    }
+    merged_row = merged_columns[0];
+    for(int i = 1; i < merged_columns.size(); i++){
+        merged_row += "\t" + merged_columns[i];
+    }
+    return true;
+}
+
+bool MergeQuery(string prefix, vector<string> & shard_dirs, vector<string> & first_dir_files, string output_dir){
+    int shard_num = shard_dirs.size();
+    vector<string> dir_by_shard(shard_num, "");
+    vector<ShardStat> stat_by_shard(shard_num);
+    for(int i = 0; i < shard_num; i++){
+        ShardStat shard_stat;
+        if(!ReadShardStat(shard_dirs[i] + "/" + prefix + ".stat", shard_stat)) return false;
+        if(shard_stat.shard_num != shard_num){
+            cout << "[Error] " << shard_dirs[i] << " is shard " << shard_stat.shard_index << " of " << shard_stat.shard_num
+                 << ", but " << shard_num << " shards are given" << endl;
+            return false;
+        }
+        if(dir_by_shard[shard_stat.shard_index] != ""){
+            cout << "[Error] shard " << shard_stat.shard_index << " is given twice" << endl;
+            return false;
+        }
+        dir_by_shard[shard_stat.shard_index] = shard_dirs[i];
+        stat_by_shard[shard_stat.shard_index] = shard_stat;
+    }
+
+    ShardStat & merged_stat = stat_by_shard[0];
+    for(int i = 1; i < shard_num; i++){
+        ShardStat & shard_stat = stat_by_shard[i];
+        if(shard_stat.baseline_line != merged_stat.baseline_line ||
+           shard_stat.query_line != merged_stat.query_line ||
+           shard_stat.rows.size() != merged_stat.rows.size()){
+            cout << "[Error] shards of " << prefix << " are not from the same input" << endl;
+            return false;
+        }
+        for(int k = 0; k < merged_stat.rows.size(); k++){
+            if(!MergeStatRow(merged_stat.rows[k], shard_stat.rows[k])){
+                cout << "[Error] shards of " << prefix << " have different modes or thresholds" << endl;
+                return false;
+            }
+        }
+    }
+
+    ofstream output_stat_file;
+    output_stat_file.open(output_dir + "/" + prefix + ".stat");
+    output_stat_file << merged_stat.baseline_line << endl;
+    output_stat_file << merged_stat.query_line << endl;
+    output_stat_file << merged_stat.head_line << endl;
+    for(int k = 0; k < merged_stat.rows.size(); k++){
+        output_stat_file << merged_stat.rows[k] << endl;
+    }
+    output_stat_file.close();
+
+    // header lines are taken from the first shard only
+    for(int f = 0; f < first_dir_files.size(); f++){
+        string file_name = first_dir_files[f];
+        if(file_name.compare(0, prefix.size() + 1, prefix + ".") != 0 || !EndsWith(file_name, ".match")) continue;
+        ofstream output_match_file;
+        output_match_file.open(output_dir + "/" + file_name);
+        for(int i = 0; i < shard_num; i++){
+            ifstream input(dir_by_shard[i] + "/" + file_name);
+            if(!input.good()){
+                cout << "[Error] can not read " << dir_by_shard[i] + "/" + file_name << endl;
+                return false;
+            }
+            string line;
+            while(std::getline(input, line).good()){
+                if(i > 0 && line.size() > 0 && line[0] == '#') continue;
+                output_match_file << line << "\n";
+            }
+        }
+        output_match_file.close();
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]){
+
+    Args args;
+    TclapParser(args, argc, argv);
+
+    vector<string> first_dir_files = ListFiles(args.shard_dirs[0]);
+    int merged_num = 0;
+    for(int f = 0; f < first_dir_files.size(); f++){
+        if(!EndsWith(first_dir_files[f], ".stat")) continue;
+        string prefix = first_dir_files[f].substr(0, first_dir_files[f].size() - 5);
+        if(!MergeQuery(prefix, args.shard_dirs, first_dir_files, args.output_dir)) return 1;
+        merged_num++;
+    }
+    cout << "merged " << merged_num << " queries from " << args.shard_dirs.size() << " shards" << endl;
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include "threadpool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+ThreadPool::ThreadPool(){
+    stopping = false;
+    busy_worker_num = 0;
+    pin_threads = false;
+    node_num = 1;
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_condition.notify_all();
+    for(int i = 0; i < workers.size(); i++){
+        workers[i].join();
+    }
+}
+
+ThreadPool & ThreadPool::Shared(){
+    static ThreadPool thread_pool;
+    return thread_pool;
+}
+
+// cpus of every node from sysfs, all cpus are one node when sysfs has no nodes
+void ThreadPool::ReadCpuNodes(){
+    cpus_by_node.clear();
+    DIR * dir = opendir("/sys/devices/system/node");
+    if(dir != NULL){
+        vector<string> node_names;
+        struct dirent * entry;
+        while((entry = readdir(dir)) != NULL){
+            string name = entry->d_name;
+            if(name.size() > 4 && name.compare(0, 4, "node") == 0 && isdigit(name[4])) node_names.push_back(name);
+        }
+        closedir(dir);
+        sort(node_names.begin(), node_names.end(), [](const string & a, const string & b){
+            return atoi(a.c_str() + 4) < atoi(b.c_str() + 4);
+        });
+        for(int i = 0; i < node_names.size(); i++){
+            ifstream cpulist_file(("/sys/devices/system/node/" + node_names[i] + "/cpulist").c_str());
+            string cpulist;
+            if(!getline(cpulist_file, cpulist)) continue;
+            // e.g. 0-3,8-11
+            vector<int> cpus;
+            size_t start = 0;
+            while(start < cpulist.size()){
+                size_t end = cpulist.find(',', start);
+                if(end == string::npos) end = cpulist.size();
+                string range = cpulist.substr(start, end - start);
+                size_t dash = range.find('-');
+                if(!range.empty()){
+                    int first = atoi(range.c_str());
+                    int last = (dash == string::npos) ? first : atoi(range.c_str() + dash + 1);
+                    for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+                }
+                start = end + 1;
+            }
+            if(cpus.size() > 0) cpus_by_node.push_back(cpus);
+        }
+    }
+    if(cpus_by_node.size() == 0){
+        int cpu_num = max(1, (int)thread::hardware_concurrency());
+        cpus_by_node.push_back(vector<int>());
+        for(int cpu = 0; cpu < cpu_num; cpu++) cpus_by_node[0].push_back(cpu);
+    }
+
+    node_num = cpus_by_node.size();
+    node_by_cpu.clear();
+    for(int n = 0; n < node_num; n++){
+        for(int k = 0; k < cpus_by_node[n].size(); k++){
+            int cpu = cpus_by_node[n][k];
+            if(cpu >= node_by_cpu.size()) node_by_cpu.resize(cpu + 1, 0);
+            node_by_cpu[cpu] = n;
+        }
+    }
+    cpu_list.clear();
+    node_by_cpu_index.clear();
+    for(int k = 0; ; k++){
+        bool added = false;
+        for(int n = 0; n < node_num; n++){
+            if(k >= cpus_by_node[n].size()) continue;
+            cpu_list.push_back(cpus_by_node[n][k]);
+            node_by_cpu_index.push_back(n);
+            added = true;
+        }
+        if(!added) break;
+    }
+}
+
+void ThreadPool::SetPinning(bool pin_threads_){
+    lock_guard<mutex> lock(queue_mutex);
+    pin_threads = pin_threads_;
+    if(pin_threads && cpu_list.size() == 0) ReadCpuNodes();
+}
+
+// the first cpu is left to the thread calling ParallelFor, usually the main thread
+void ThreadPool::PinThread(thread & t, int worker_index){
+    if(cpu_list.size() == 0) return;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu_list[(worker_index + 1) % cpu_list.size()], &cpu_set);
+    pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpu_set);
+}
+
+int ThreadPool::CurrentNode(){
+    if(node_num <= 1) return 0;
+    int cpu = sched_getcpu();
+    if(cpu < 0 || cpu >= node_by_cpu.size()) return 0;
+    return node_by_cpu[cpu];
+}
+
+void ThreadPool::PinCurrentThreadToNode(int node){
+    if(node < 0 || node >= cpus_by_node.size()) return;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for(int k = 0; k < cpus_by_node[node].size(); k++){
+        CPU_SET(cpus_by_node[node][k], &cpu_set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+}
+
+void ThreadPool::RunOnNode(int node, function<void()> f){
+    thread node_thread([this, node, &f](){
+        PinCurrentThreadToNode(node);
+        f();
+    });
+    node_thread.join();
+}
+
+void ThreadPool::Reserve(int worker_num){
+    lock_guard<mutex> lock(queue_mutex);
+    StartWorkers(worker_num);
+}
+
+// called with queue_mutex held
+void ThreadPool::StartWorkers(int worker_num){
+    while(workers.size() < worker_num){
+        int worker_index = workers.size();
+        workers.push_back(thread(&ThreadPool::WorkerLoop, this, worker_index));
+        if(pin_threads) PinThread(workers.back(), worker_index);
+    }
+}
+
+void ThreadPool::WorkerLoop(int worker_index){
+    while(true){
+        shared_ptr<ParallelTask> parallel_task;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_condition.wait(lock, [this]{ return stopping || !task_queue.empty(); });
+            if(task_queue.empty()) return;
+            parallel_task = task_queue.front();
+            task_queue.pop_front();
+            busy_worker_num++;
+        }
+        RunTasks(*parallel_task);
+        lock_guard<mutex> lock(queue_mutex);
+        busy_worker_num--;
+    }
+}
+
+void ThreadPool::RunTasks(ParallelTask & parallel_task){
+    while(true){
+        int index = parallel_task.next_index.fetch_add(1);
+        if(index >= parallel_task.task_num) return;
+        parallel_task.task(index);
+        lock_guard<mutex> lock(parallel_task.done_mutex);
+        parallel_task.done_num++;
+        if(parallel_task.done_num == parallel_task.task_num) parallel_task.done_condition.notify_all();
+    }
+}
+
+// the caller takes indexes as well, so tasks are done even when every worker is busy
+// with other calls, e.g. nested calls or concurrent queries of vm-server.
+// workers are added for the whole demand, busy ones and queued entries of other calls included,
+// so that nested and concurrent calls together get the workers they ask for
+void ThreadPool::ParallelFor(int task_num, function<void(int)> task, int worker_num){
+    if(task_num <= 0) return;
+    if(worker_num <= 0 || worker_num > task_num) worker_num = task_num;
+    if(worker_num == 1){
+        for(int i = 0; i < task_num; i++) task(i);
+        return;
+    }
+    shared_ptr<ParallelTask> parallel_task(new ParallelTask(task_num, task));
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        for(int i = 0; i < worker_num - 1; i++){
+            task_queue.push_back(parallel_task);
+        }
+        StartWorkers(busy_worker_num + task_queue.size());
+    }
+    queue_condition.notify_all();
+
+    RunTasks(*parallel_task);
+    unique_lock<mutex> lock(parallel_task->done_mutex);
+    parallel_task->done_condition.wait(lock, [&parallel_task]{ return parallel_task->done_num == parallel_task->task_num; });
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+
+using namespace std;
+
+// indexes of one ParallelFor call, taken one at a time by pool workers and the caller
+typedef struct ParallelTask{
+    ParallelTask(int task_num_,
+    function<void(int)> task_) :
+    task_num(task_num_),
+    task(task_),
+    next_index(0),
+    done_num(0){}
+
+    int task_num;
+    function<void(int)> task;
+    atomic<int> next_index;
+    int done_num;
+    mutex done_mutex;
+    condition_variable done_condition;
+}ParallelTask;
+
+// worker threads kept for the lifetime of the process, shared by all stages and queries
+// so that threads are not created and joined for every step
+class ThreadPool
+{
+private:
+    vector<thread> workers;
+    deque<shared_ptr<ParallelTask> > task_queue;
+    mutex queue_mutex;
+    condition_variable queue_condition;
+    bool stopping;
+    int busy_worker_num; // workers running a task taken from task_queue
+
+    // cpus in pinning order, nodes taken in turn so that few threads still use every node
+    bool pin_threads;
+    vector<int> cpu_list;
+    vector<int> node_by_cpu_index;
+    int node_num;
+    vector<vector<int> > cpus_by_node;
+    vector<int> node_by_cpu;
+
+    void WorkerLoop(int worker_index);
+    void StartWorkers(int worker_num);
+    void ReadCpuNodes();
+    void PinThread(thread & t, int worker_index);
+    static void RunTasks(ParallelTask & parallel_task);
+
+public:
+    ThreadPool();
+    ~ThreadPool();
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    static ThreadPool & Shared();
+
+    // applies to workers started afterwards, set before the first ParallelFor
+    void SetPinning(bool pin_threads_);
+    void Reserve(int worker_num);
+    int NodeNum(){ return node_num; }
+
+    // node of the cpu the calling thread runs on, 0 before pinning is set
+    int CurrentNode();
+    // restricts the calling thread to the cpus of a node
+    void PinCurrentThreadToNode(int node);
+    // runs f on a thread of the node and waits for it, memory f first touches is on that node
+    void RunOnNode(int node, function<void()> f);
+
+    // calls task(0) ... task(task_num-1) on the caller and pool workers, at most worker_num
+    // at the same time (task_num when 0), and returns when all have returned.
+    // may be called from inside a task
+    void ParallelFor(int task_num, function<void(int)> task, int worker_num = 0);
+};
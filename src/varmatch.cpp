@@ -0,0 +1,124 @@
+#include "varmatch.h"
+#include "wholegenome.h"
+#include "threadpool.h"
+
+VarMatch::VarMatch(const VarMatchOptions & options_){
+    options = options_;
+    loaded = false;
+    query_num = 0;
+    if(options.pin_threads) ThreadPool::Shared().SetPinning(true);
+    whole_genome = new WholeGenome(options.thread_num,
+                                   options.output_dir,
+                                   options.pr_curves,
+                                   false,
+                                   10,
+                                   ClusterBudget(options.max_path_num,
+                                                 options.max_path_memory,
+                                                 options.max_cluster_seconds),
+                                   options.best_first_search,
+                                   0,
+                                   options.split_clusters,
+                                   options.exact_prepass);
+    whole_genome->SetNumaReplicas(options.numa);
+}
+
+VarMatch::~VarMatch(){
+    delete whole_genome;
+}
+
+bool VarMatch::SetTargetRegions(vector<string> region_strings, string region_filename){
+    if(loaded){
+        cout << "[VarMatch] Error: regions should be given before the baseline is loaded" << endl;
+        return false;
+    }
+    return whole_genome->SetTargetRegions(region_strings, region_filename);
+}
+
+bool VarMatch::ReadBedRegions(string bed_filename){
+    if(loaded){
+        cout << "[VarMatch] Error: regions should be given before the baseline is loaded" << endl;
+        return false;
+    }
+    return whole_genome->ReadBedRegions(bed_filename);
+}
+
+bool VarMatch::Load(string genome_filename, string baseline_vcf_filename){
+    if(loaded){
+        cout << "[VarMatch] Error: baseline is already loaded" << endl;
+        return false;
+    }
+    if(options.score_scheme == 3){
+        loaded = whole_genome->ReadDirectRef(genome_filename, baseline_vcf_filename);
+    }else{
+        loaded = whole_genome->ReadRef(genome_filename, baseline_vcf_filename);
+    }
+    return loaded;
+}
+
+void VarMatch::SetOutputDir(string output_dir){
+    options.output_dir = output_dir;
+    whole_genome->SetOutputDir(output_dir);
+}
+
+bool VarMatch::MatchFile(string query_vcf_filename,
+                         MatchRecordCallback record_callback,
+                         MatchStatCallback stat_callback,
+                         string output_prefix){
+    if(!loaded){
+        cout << "[VarMatch] Error: baseline is not loaded" << endl;
+        return false;
+    }
+    if(!FileExists(query_vcf_filename)){
+        cout << "[VarMatch] Error: can not open vcf file " << query_vcf_filename << endl;
+        return false;
+    }
+    query_num++;
+    if(output_prefix == "") output_prefix = "query" + to_string(query_num);
+    whole_genome->SetResultCallbacks(record_callback, stat_callback, options.output_dir != "");
+    bool matched = whole_genome->Compare(query_vcf_filename,
+                                         output_prefix,
+                                         false,
+                                         options.score_unit,
+                                         options.match_mode,
+                                         options.score_scheme);
+    whole_genome->SetResultCallbacks(MatchRecordCallback(), MatchStatCallback(), true);
+    return matched;
+}
+
+// records are written as VCF lines and read the same way as a query file
+bool VarMatch::MatchRecords(const vector<VarMatchRecord> & query_records,
+                            MatchRecordCallback record_callback,
+                            MatchStatCallback stat_callback,
+                            string output_prefix){
+    if(!loaded){
+        cout << "[VarMatch] Error: baseline is not loaded" << endl;
+        return false;
+    }
+    bool genotype_known = true;
+    for(int i = 0; i < query_records.size(); i++){
+        if(query_records[i].genotype == "") genotype_known = false;
+    }
+    vector<string> query_lines;
+    for(int i = 0; i < query_records.size(); i++){
+        const VarMatchRecord & record = query_records[i];
+        string line = record.chr_name + "\t" + to_string(record.pos) + "\t.\t" + record.ref + "\t" + record.alt + "\t";
+        line += (record.qual < 0 ? "0" : to_string(record.qual));
+        line += "\t.\t.";
+        if(genotype_known) line += "\tGT\t" + record.genotype;
+        query_lines.push_back(line);
+    }
+
+    query_num++;
+    if(output_prefix == "") output_prefix = "query" + to_string(query_num);
+    whole_genome->SetResultCallbacks(record_callback, stat_callback, options.output_dir != "");
+    whole_genome->SetQueryLines(&query_lines);
+    bool matched = whole_genome->Compare("query" + to_string(query_num) + " in memory",
+                                         output_prefix,
+                                         false,
+                                         options.score_unit,
+                                         options.match_mode,
+                                         options.score_scheme);
+    whole_genome->SetQueryLines(NULL);
+    whole_genome->SetResultCallbacks(MatchRecordCallback(), MatchStatCallback(), true);
+    return matched;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// public interface of libvarmatch. a genome and a baseline VCF are loaded once,
+// then any number of queries are matched against them, one at a time.
+// results are passed to callbacks, files are written only when output_dir is set
+
+class WholeGenome;
+
+// options of one VarMatch object, -1 means all values as in vm-core
+typedef struct VarMatchOptions{
+    VarMatchOptions() :
+    thread_num(1),
+    output_dir(""),
+    score_unit(-1),
+    match_mode(-1),
+    score_scheme(-1),
+    pr_curves(false),
+    best_first_search(false),
+    split_clusters(false),
+    exact_prepass(false),
+    pin_threads(false),
+    numa(false),
+    max_path_num(0),
+    max_path_memory(0),
+    max_cluster_seconds(0.0){}
+
+    int thread_num;
+    std::string output_dir; // .stat and .match files of every query are also written here when not empty
+    int score_unit;
+    int match_mode;
+    int score_scheme; // 3 matches directly, without genome sequence
+    bool pr_curves;
+    bool best_first_search;
+    bool split_clusters;
+    bool exact_prepass;
+    bool pin_threads; // threads of the process-wide pool, see --pin_threads of vm-core
+    bool numa; // genome copy per NUMA node, see --numa of vm-core
+    int max_path_num;
+    int max_path_memory;
+    double max_cluster_seconds;
+}VarMatchOptions;
+
+// one query variant held in memory, fields as in a VCF line
+typedef struct VarMatchRecord{
+    VarMatchRecord(std::string chr_name_ = "",
+    int pos_ = 0,
+    std::string ref_ = "",
+    std::string alt_ = "",
+    std::string genotype_ = "",
+    double qual_ = -1.0) :
+    chr_name(chr_name_),
+    pos(pos_),
+    ref(ref_),
+    alt(alt_),
+    genotype(genotype_),
+    qual(qual_){}
+
+    std::string chr_name;
+    int pos; // 1-based
+    std::string ref;
+    std::string alt; // comma separated
+    std::string genotype; // e.g. 0|1, empty when unknown, which turns off genotype matching
+    double qual; // negative when unknown
+}VarMatchRecord;
+
+// statistics of one score unit, match mode and score scheme, one value per quality threshold
+typedef struct VarMatchStat{
+    int score_unit;
+    int match_mode;
+    int score_scheme;
+    int baseline_total_num;
+    int query_total_num;
+    std::vector<double> thresholds;
+    std::vector<int> baseline_match_num;
+    std::vector<int> query_match_num;
+    std::vector<int> query_total_num_by_threshold;
+    std::vector<int> baseline_edit_distance;
+    std::vector<int> query_edit_distance;
+}VarMatchStat;
+
+// one line of a .match file, without the line break
+typedef std::function<void(int score_unit, int match_mode, int score_scheme, const std::string & match_record)> MatchRecordCallback;
+typedef std::function<void(const VarMatchStat & stat)> MatchStatCallback;
+
+class VarMatch
+{
+private:
+    VarMatchOptions options;
+    WholeGenome * whole_genome;
+    bool loaded;
+    int query_num; // names output files of queries given in memory
+
+public:
+    VarMatch(const VarMatchOptions & options_ = VarMatchOptions());
+    ~VarMatch();
+    VarMatch(VarMatch const &) = delete;
+    VarMatch& operator=(VarMatch const&) = delete;
+
+    // regions and bed must be given before Load, see --region, --region_file and --bed of vm-core
+    bool SetTargetRegions(std::vector<std::string> region_strings, std::string region_filename = "");
+    bool ReadBedRegions(std::string bed_filename);
+
+    bool Load(std::string genome_filename, std::string baseline_vcf_filename);
+
+    // output directory of the following queries, empty for no files
+    void SetOutputDir(std::string output_dir);
+
+    // callbacks are called from the calling thread after all variants of the query are matched,
+    // either may be empty. output files are named by output_prefix, query1, query2... when empty
+    bool MatchFile(std::string query_vcf_filename,
+                   MatchRecordCallback record_callback,
+                   MatchStatCallback stat_callback,
+                   std::string output_prefix = "");
+
+    bool MatchRecords(const std::vector<VarMatchRecord> & query_records,
+                      MatchRecordCallback record_callback,
+                      MatchStatCallback stat_callback,
+                      std::string output_prefix = "");
+};
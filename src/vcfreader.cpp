@@ -0,0 +1,403 @@
+#include "vcfreader.h"
+
+using namespace std;
+
+bool ParseGenomeRegion(string region_string, GenomeRegion & region){
+    region_string.erase(remove(region_string.begin(), region_string.end(), ','), region_string.end());
+    if(region_string.empty()) return false;
+    size_t colon_pos = region_string.rfind(':');
+    if(colon_pos == string::npos){
+        region = GenomeRegion(region_string, 0, -1);
+        return true;
+    }
+    string range_string = region_string.substr(colon_pos+1);
+    if(range_string.empty() || range_string.find_first_not_of("0123456789-") != string::npos){
+        // colon is part of the chromosome name
+        region = GenomeRegion(region_string, 0, -1);
+        return true;
+    }
+    region.chr_name = region_string.substr(0, colon_pos);
+    size_t dash_pos = range_string.find('-');
+    int start = atoi(range_string.substr(0, dash_pos).c_str());
+    if(start < 1) start = 1;
+    region.start = start - 1;
+    region.end = -1;
+    if(dash_pos != string::npos && dash_pos + 1 < range_string.size()){
+        region.end = atoi(range_string.substr(dash_pos+1).c_str());
+        if(region.end <= region.start) return false;
+    }
+    return true;
+}
+
+VcfReader::VcfReader(){
+    mode = 0;
+    gz_file = NULL;
+    bgzf_file = NULL;
+    chunk_index = 0;
+    block_offset = UINT64_MAX;
+    next_block_offset = 0;
+    block_pos = 0;
+    memory_lines = NULL;
+    memory_line_index = 0;
+}
+
+VcfReader::~VcfReader(){
+    Close();
+}
+
+void VcfReader::Close(){
+    if(plain_file.is_open()) plain_file.close();
+    if(gz_file != NULL){
+        gzclose(gz_file);
+        gz_file = NULL;
+    }
+    if(bgzf_file != NULL){
+        fclose(bgzf_file);
+        bgzf_file = NULL;
+    }
+    chunks.clear();
+    block.clear();
+    memory_lines = NULL;
+    memory_line_index = 0;
+}
+
+bool VcfReader::OpenLines(const vector<string> * lines){
+    Close();
+    if(lines == NULL) return false;
+    mode = 3;
+    memory_lines = lines;
+    memory_line_index = 0;
+    return true;
+}
+
+bool VcfReader::Open(string filename, const vector<GenomeRegion> & regions){
+    Close();
+    ifstream test_file(filename.c_str(), ios::binary);
+    if(!test_file.good()) return false;
+    unsigned char magic[2] = {0, 0};
+    test_file.read((char*)magic, 2);
+    test_file.close();
+    bool gzip_file = (magic[0] == 31 && magic[1] == 139);
+
+    if(!gzip_file){
+        mode = 0;
+        plain_file.open(filename.c_str());
+        return plain_file.good();
+    }
+
+    if(regions.size() > 0){
+        string index_filename = "";
+        if(FileExists(filename + ".tbi")){
+            index_filename = filename + ".tbi";
+        }else if(FileExists(filename + ".csi")){
+            index_filename = filename + ".csi";
+        }
+        if(index_filename != "" && ReadIndex(index_filename, regions)){
+            bgzf_file = fopen(filename.c_str(), "rb");
+            if(bgzf_file == NULL) return false;
+            mode = 2;
+            chunk_index = 0;
+            block.clear();
+            block_offset = UINT64_MAX;
+            next_block_offset = 0;
+            block_pos = 0;
+            return true;
+        }
+        cout << "[VarMatch] Warning: no usable index for " << filename << ", reading the whole file" << endl;
+    }
+
+    mode = 1;
+    gz_file = gzopen(filename.c_str(), "rb");
+    return gz_file != NULL;
+}
+
+// tabix (.tbi) and CSI indexes, chunks of bins overlapping regions are collected,
+// skipping chunks that end before the first record of a region
+bool VcfReader::ReadIndex(string index_filename, const vector<GenomeRegion> & regions){
+    gzFile index_file = gzopen(index_filename.c_str(), "rb");
+    if(index_file == NULL) return false;
+    string data;
+    char buffer[65536];
+    int read_size;
+    while((read_size = gzread(index_file, buffer, sizeof(buffer))) > 0){
+        data.append(buffer, read_size);
+    }
+    gzclose(index_file);
+
+    size_t p = 0;
+    bool truncated = false;
+    auto read_int = [&](int bytes) -> uint64_t {
+        if(p + bytes > data.size()){
+            truncated = true;
+            p = data.size();
+            return 0;
+        }
+        uint64_t value = 0;
+        for(int i = 0; i < bytes; i++){
+            value |= (uint64_t)(unsigned char)data[p+i] << (8*i);
+        }
+        p += bytes;
+        return value;
+    };
+
+    if(data.size() < 4) return false;
+    bool csi = false;
+    if(data.compare(0, 4, string("TBI\1", 4)) == 0){
+        csi = false;
+    }else if(data.compare(0, 4, string("CSI\1", 4)) == 0){
+        csi = true;
+    }else{
+        return false;
+    }
+    p = 4;
+
+    int min_shift = TBI_MIN_SHIFT;
+    int depth = TBI_DEPTH;
+    int n_ref = 0;
+    string names;
+    if(csi){
+        min_shift = (int)read_int(4);
+        depth = (int)read_int(4);
+        int l_aux = (int)read_int(4);
+        size_t aux_end = p + l_aux;
+        if(l_aux >= 28){
+            p += 24; // format, col_seq, col_beg, col_end, meta, skip
+            int l_nm = (int)read_int(4);
+            if(p + l_nm <= data.size()) names = data.substr(p, l_nm);
+        }
+        p = aux_end;
+        n_ref = (int)read_int(4);
+    }else{
+        n_ref = (int)read_int(4);
+        p += 24;
+        int l_nm = (int)read_int(4);
+        if(p + l_nm <= data.size()) names = data.substr(p, l_nm);
+        p += l_nm;
+    }
+    if(truncated || p > data.size()) return false;
+
+    map<string, int> ref_id_by_name;
+    size_t name_start = 0;
+    for(int i = 0; name_start < names.size(); i++){
+        size_t name_end = names.find('\0', name_start);
+        if(name_end == string::npos) name_end = names.size();
+        ref_id_by_name[names.substr(name_start, name_end - name_start)] = i;
+        name_start = name_end + 1;
+    }
+
+    map<int, vector<GenomeRegion> > regions_by_ref_id;
+    for(int i = 0; i < regions.size(); i++){
+        auto it = ref_id_by_name.find(regions[i].chr_name);
+        if(it == ref_id_by_name.end()) continue;
+        regions_by_ref_id[it->second].push_back(regions[i]);
+    }
+
+    chunks.clear();
+    uint64_t max_position = (uint64_t)1 << (min_shift + depth*3);
+    for(int r = 0; r < n_ref && !truncated; r++){
+        map<uint32_t, vector<pair<uint64_t, uint64_t> > > chunks_by_bin;
+        map<uint32_t, uint64_t> loffset_by_bin;
+        int n_bin = (int)read_int(4);
+        for(int b = 0; b < n_bin && !truncated; b++){
+            uint32_t bin = (uint32_t)read_int(4);
+            if(csi) loffset_by_bin[bin] = read_int(8);
+            int n_chunk = (int)read_int(4);
+            vector<pair<uint64_t, uint64_t> > & bin_chunks = chunks_by_bin[bin];
+            for(int c = 0; c < n_chunk && !truncated; c++){
+                uint64_t chunk_begin = read_int(8);
+                uint64_t chunk_end = read_int(8);
+                bin_chunks.push_back(make_pair(chunk_begin, chunk_end));
+            }
+        }
+        vector<uint64_t> linear_index;
+        if(!csi){
+            int n_intv = (int)read_int(4);
+            for(int i = 0; i < n_intv && !truncated; i++){
+                linear_index.push_back(read_int(8));
+            }
+        }
+
+        auto region_it = regions_by_ref_id.find(r);
+        if(region_it == regions_by_ref_id.end()) continue;
+        for(int i = 0; i < region_it->second.size(); i++){
+            uint64_t begin = region_it->second[i].start;
+            uint64_t end = region_it->second[i].end < 0 ? max_position : region_it->second[i].end;
+            if(end > max_position) end = max_position;
+            if(begin >= end) continue;
+            end -= 1;
+
+            uint64_t min_offset = 0;
+            if(!csi){
+                if(linear_index.size() > 0){
+                    uint64_t window = begin >> min_shift;
+                    if(window >= linear_index.size()) window = linear_index.size() - 1;
+                    min_offset = linear_index[window];
+                }
+            }else{
+                // first record of the smallest bin holding begin
+                uint32_t bin = (uint32_t)((((uint64_t)1 << (3*depth)) - 1) / 7 + (begin >> min_shift));
+                while(true){
+                    auto loffset_it = loffset_by_bin.find(bin);
+                    if(loffset_it != loffset_by_bin.end()){
+                        min_offset = loffset_it->second;
+                        break;
+                    }
+                    if(bin == 0) break;
+                    bin = (bin - 1) >> 3;
+                }
+            }
+
+            uint64_t level_offset = 0;
+            int shift = min_shift + depth*3;
+            for(int level = 0; level <= depth; level++){
+                uint64_t first_bin = level_offset + (begin >> shift);
+                uint64_t last_bin = level_offset + (end >> shift);
+                for(uint64_t bin = first_bin; bin <= last_bin; bin++){
+                    auto bin_it = chunks_by_bin.find((uint32_t)bin);
+                    if(bin_it == chunks_by_bin.end()) continue;
+                    for(int c = 0; c < bin_it->second.size(); c++){
+                        if(bin_it->second[c].second > min_offset){
+                            chunks.push_back(bin_it->second[c]);
+                        }
+                    }
+                }
+                level_offset += (uint64_t)1 << (level*3);
+                shift -= 3;
+            }
+        }
+    }
+    if(truncated) return false;
+
+    sort(chunks.begin(), chunks.end());
+    vector<pair<uint64_t, uint64_t> > merged_chunks;
+    for(int i = 0; i < chunks.size(); i++){
+        if(merged_chunks.size() > 0 && chunks[i].first <= merged_chunks.back().second){
+            merged_chunks.back().second = max(merged_chunks.back().second, chunks[i].second);
+        }else{
+            merged_chunks.push_back(chunks[i]);
+        }
+    }
+    chunks.swap(merged_chunks);
+    return true;
+}
+
+// one BGZF block is a complete gzip member, its size is in the BC extra field
+bool VcfReader::LoadBlock(uint64_t offset){
+    block.clear();
+    block_pos = 0;
+    block_offset = offset;
+    next_block_offset = offset;
+    if(fseeko(bgzf_file, (off_t)offset, SEEK_SET) != 0) return false;
+    unsigned char header[12];
+    if(fread(header, 1, 12, bgzf_file) != 12) return false;
+    if(header[0] != 31 || header[1] != 139 || (header[3] & 4) == 0) return false;
+    int xlen = header[10] | (header[11] << 8);
+    string extra(xlen, '\0');
+    if(fread(&extra[0], 1, xlen, bgzf_file) != xlen) return false;
+    int block_size = -1;
+    for(int i = 0; i + 4 <= xlen; ){
+        int subfield_length = (unsigned char)extra[i+2] | ((unsigned char)extra[i+3] << 8);
+        if(extra[i] == 'B' && extra[i+1] == 'C' && subfield_length == 2 && i + 6 <= xlen){
+            block_size = ((unsigned char)extra[i+4] | ((unsigned char)extra[i+5] << 8)) + 1;
+        }
+        i += 4 + subfield_length;
+    }
+    if(block_size < 12 + xlen + 8) return false;
+
+    string compressed((char*)header, 12);
+    compressed += extra;
+    compressed.resize(block_size);
+    size_t rest_size = block_size - 12 - xlen;
+    if(fread(&compressed[12 + xlen], 1, rest_size, bgzf_file) != rest_size) return false;
+    uint32_t uncompressed_size = (unsigned char)compressed[block_size-4] |
+                                 ((unsigned char)compressed[block_size-3] << 8) |
+                                 ((unsigned char)compressed[block_size-2] << 16) |
+                                 ((uint32_t)(unsigned char)compressed[block_size-1] << 24);
+    next_block_offset = offset + block_size;
+    if(uncompressed_size == 0) return true;
+
+    block.resize(uncompressed_size);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, 15 + 16) != Z_OK) return false;
+    zs.next_in = (Bytef*)&compressed[0];
+    zs.avail_in = block_size;
+    zs.next_out = (Bytef*)&block[0];
+    zs.avail_out = uncompressed_size;
+    int status = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if(status != Z_STREAM_END){
+        block.clear();
+        return false;
+    }
+    return true;
+}
+
+uint64_t VcfReader::VirtualOffset(){
+    if(block_pos >= block.size()) return next_block_offset << 16;
+    return (block_offset << 16) | (uint64_t)block_pos;
+}
+
+void VcfReader::Seek(uint64_t virtual_offset){
+    uint64_t offset = virtual_offset >> 16;
+    if(offset != block_offset || block.empty()){
+        LoadBlock(offset);
+    }
+    block_pos = (int)(virtual_offset & 0xffff);
+}
+
+bool VcfReader::ReadLine(string & line){
+    line.clear();
+    if(mode == 0){
+        return (bool)getline(plain_file, line);
+    }
+
+    if(mode == 3){
+        if(memory_line_index >= memory_lines->size()) return false;
+        line = memory_lines->at(memory_line_index++);
+        return true;
+    }
+
+    if(mode == 1){
+        char buffer[65536];
+        while(gzgets(gz_file, buffer, sizeof(buffer)) != NULL){
+            line += buffer;
+            if(line[line.size()-1] == '\n'){
+                line.erase(line.size()-1);
+                return true;
+            }
+        }
+        return !line.empty();
+    }
+
+    while(true){
+        if(chunk_index >= chunks.size()) return false;
+        uint64_t virtual_offset = VirtualOffset();
+        if(virtual_offset >= chunks[chunk_index].second){
+            chunk_index++;
+            continue;
+        }
+        if(virtual_offset < chunks[chunk_index].first){
+            Seek(chunks[chunk_index].first);
+        }
+        break;
+    }
+    while(true){
+        if(block_pos >= block.size()){
+            if(!LoadBlock(next_block_offset) || block.empty()){
+                chunk_index = chunks.size();
+                return !line.empty();
+            }
+            continue;
+        }
+        size_t newline_pos = block.find('\n', block_pos);
+        if(newline_pos == string::npos){
+            line.append(block, block_pos, string::npos);
+            block_pos = block.size();
+            continue;
+        }
+        line.append(block, block_pos, newline_pos - block_pos);
+        block_pos = newline_pos + 1;
+        return true;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <zlib.h>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <algorithm>
+#include "util.h"
+
+// 0-based half-open region of one chromosome, end < 0 means to the end of the chromosome
+typedef struct GenomeRegion{
+    GenomeRegion(string chr_name_ = "",
+    int start_ = 0,
+    int end_ = -1) :
+    chr_name(chr_name_),
+    start(start_),
+    end(end_){}
+
+    string chr_name;
+    int start;
+    int end;
+}GenomeRegion;
+
+// chr, chr:start or chr:start-end with 1-based inclusive positions, commas in numbers are allowed
+bool ParseGenomeRegion(string region_string, GenomeRegion & region);
+
+// reads lines of a plain, gzip or bgzip VCF. with regions and a .tbi or .csi index next to a bgzip VCF,
+// only the blocks the index gives for the regions are read, lines outside regions may still be returned
+class VcfReader
+{
+private:
+    int mode; // 0: plain, 1: gzip stream, 2: bgzip blocks from index, 3: lines in memory
+    ifstream plain_file;
+    gzFile gz_file;
+    FILE * bgzf_file;
+
+    vector<pair<uint64_t, uint64_t> > chunks; // virtual offsets, sorted and merged
+    int chunk_index;
+    string block;
+    uint64_t block_offset; // compressed offset of the loaded block
+    uint64_t next_block_offset;
+    int block_pos;
+
+    const vector<string> * memory_lines;
+    int memory_line_index;
+
+    bool ReadIndex(string index_filename, const vector<GenomeRegion> & regions);
+    bool LoadBlock(uint64_t offset);
+    void Seek(uint64_t virtual_offset);
+    uint64_t VirtualOffset();
+
+public:
+    VcfReader();
+    ~VcfReader();
+    VcfReader(VcfReader const &) = delete;
+    VcfReader& operator=(VcfReader const&) = delete;
+
+    bool Open(string filename, const vector<GenomeRegion> & regions);
+    // lines are not copied and must outlive the reader
+    bool OpenLines(const vector<string> * lines);
+    bool ReadLine(string & line);
+    void Close();
+    bool Indexed(){ return mode == 2; }
+
+    const static int TBI_MIN_SHIFT = 14;
+    const static int TBI_DEPTH = 5;
+};
@@ -5,6 +5,7 @@
 #include <thread>
 #include <tclap/CmdLine.h>
 #include "wholegenome.h"
+#include "threadpool.h"
 
 using namespace std;
 
@@ -22,6 +23,21 @@ typedef struct Args {
     vector<string> query_file_list;
     bool pr_curves;
     bool direct_match;
+    bool cluster_report;
+    int report_top_num;
+    int max_path_num;
+    int max_path_memory;
+    double max_cluster_time;
+    bool best_first_search;
+    int parallel_cluster_size;
+    bool split_clusters;
+    bool exact_prepass;
+    string bed_filename;
+    vector<string> region_list;
+    string region_filename;
+    string shard;
+    bool pin_threads;
+    bool numa;
 
 //	bool direct_search;
 //	string chr_name;
@@ -105,6 +121,63 @@ bool TclapParser(Args & args, int argc, char** argv){
         string precision_recall_string = "Disable Precision-Recall curves. \n";
         TCLAP::SwitchArg arg_disable_curves("C", "disable_curves", precision_recall_string, cmd, false);
 
+        string cluster_report_string = "output cluster report, by default do not output.\n"
+        "filename in format PREFIX.cluster.json\n"
+        "The report contains cluster size distribution, number of paths explored per cluster "
+        "and the slowest clusters with their coordinates.";
+        TCLAP::SwitchArg arg_cluster_report("r", "cluster_report", cluster_report_string, cmd, false);
+
+        TCLAP::ValueArg<int> arg_report_top_num("", "report_top", "number of slowest clusters listed in cluster report, default is 10", false, 10, "int");
+
+        string budget_string = "\nWhen a cluster exceeds any of these limits, variants inside it are only matched directly "
+        "(identical entries), and the cluster is listed in the cluster report. 0 means unlimited (Default: 0)";
+        TCLAP::ValueArg<int> arg_max_path_num("", "max_paths", "maximum number of paths kept when matching one cluster." + budget_string, false, 0, "int");
+        TCLAP::ValueArg<int> arg_max_path_memory("", "max_path_memory", "maximum memory (MB) of paths when matching one cluster." + budget_string, false, 0, "int");
+        TCLAP::ValueArg<double> arg_max_cluster_time("", "max_cluster_time", "maximum time (seconds) spent on matching one cluster." + budget_string, false, 0.0, "float");
+
+        string best_first_string = "use best-first search instead of exhaustive path extension when matching a cluster.\n"
+        "Results have the same score; among equally scored matchings a different one may be reported.";
+        TCLAP::SwitchArg arg_best_first("", "best_first", best_first_string, cmd, false);
+
+        string parallel_cluster_string = "clusters with more variants than this are matched after all other clusters, "
+        "with paths of each cluster expanded by all threads. Not used with --best_first. 0 means disabled (Default: 0)";
+        string split_clusters_string = "split clusters at gaps between variants where every matching has to be in sync, "
+        "i.e. gaps longer than the largest length offset both sides can create and without a period up to that offset. "
+        "Parts are matched independently, their match records are reported separately.";
+        TCLAP::SwitchArg arg_split_clusters("", "split_clusters", split_clusters_string, cmd, false);
+        string exact_prepass_string = "match identical baseline and query variants before clustering and cluster only the rest. "
+        "Faster on concordant call sets; an identical pair is never broken up to match its variants otherwise.";
+        TCLAP::SwitchArg arg_exact_prepass("", "exact_prepass", exact_prepass_string, cmd, false);
+        string bed_string = "only match variants starting inside regions of this BED file, "
+        "chromosomes not in the file are not restricted (same as filter_hc)";
+        TCLAP::ValueArg<std::string> arg_bed_filename("", "bed", bed_string, false, "", "file");
+        string region_string = "only match variants starting in this region, chr, chr:start or chr:start-end (1-based, inclusive). "
+        "Can be given more than once. With a .tbi or .csi index next to a bgzipped VCF, and a .fai next to the genome, "
+        "only the parts of the files holding these regions are read";
+        TCLAP::MultiArg<std::string> arg_region_list("", "region", region_string, false, "string");
+        string region_file_string = "file of regions, one per line, in --region format or as BED lines";
+        TCLAP::ValueArg<std::string> arg_region_filename("", "region_file", region_file_string, false, "", "file");
+        string shard_string = "i/N: only match shard i (0 <= i < N) of N shards, each a contiguous range of clusters. "
+        "Run every shard into its own output directory and combine them with merge_shards";
+        TCLAP::ValueArg<std::string> arg_shard("", "shard", shard_string, false, "", "i/N");
+
+        string pin_threads_string = "pin threads of the thread pool to cpus, taking NUMA nodes in turn";
+        TCLAP::SwitchArg arg_pin_threads("", "pin_threads", pin_threads_string, cmd, false);
+        string numa_string = "copy the genome to every NUMA node and pin threads, so that matching threads "
+        "read the genome from their own node. Uses one more genome worth of memory per node";
+        TCLAP::SwitchArg arg_numa("", "numa", numa_string, cmd, false);
+
+        TCLAP::ValueArg<int> arg_parallel_cluster_size("", "parallel_cluster_size", parallel_cluster_string, false, 0, "int");
+
+        cmd.add(arg_bed_filename);
+        cmd.add(arg_region_list);
+        cmd.add(arg_region_filename);
+        cmd.add(arg_shard);
+        cmd.add(arg_parallel_cluster_size);
+        cmd.add(arg_max_cluster_time);
+        cmd.add(arg_max_path_memory);
+        cmd.add(arg_max_path_num);
+        cmd.add(arg_report_top_num);
         cmd.add(arg_score_scheme);
         cmd.add(arg_match_mode);
         cmd.add(arg_score_unit);
@@ -130,6 +203,22 @@ bool TclapParser(Args & args, int argc, char** argv){
 		args.score_scheme = arg_score_scheme.getValue();
         args.detail_results = arg_detail_results.getValue();
         args.pr_curves = ! arg_disable_curves.getValue();
+        args.cluster_report = arg_cluster_report.getValue();
+        args.report_top_num = arg_report_top_num.getValue();
+        if(args.report_top_num < 0) args.report_top_num = 0;
+        args.max_path_num = arg_max_path_num.getValue();
+        args.max_path_memory = arg_max_path_memory.getValue();
+        args.max_cluster_time = arg_max_cluster_time.getValue();
+        args.best_first_search = arg_best_first.getValue();
+        args.parallel_cluster_size = arg_parallel_cluster_size.getValue();
+        args.split_clusters = arg_split_clusters.getValue();
+        args.exact_prepass = arg_exact_prepass.getValue();
+        args.bed_filename = arg_bed_filename.getValue();
+        args.region_list = arg_region_list.getValue();
+        args.region_filename = arg_region_filename.getValue();
+        args.shard = arg_shard.getValue();
+        args.pin_threads = arg_pin_threads.getValue();
+        args.numa = arg_numa.getValue();
         //args.direct_match = arg_direct_match.getValue();
 	}
 	catch (TCLAP::ArgException &e)
@@ -169,9 +258,19 @@ int main(int argc, char* argv[])
     TclapParser(args, argc, argv);
 
     //return 0;
+    ThreadPool::Shared().SetPinning(args.pin_threads);
     WholeGenome wg(args.thread_num,
                    args.output_dir,
-                   args.pr_curves);
+                   args.pr_curves,
+                   args.cluster_report,
+                   args.report_top_num,
+                   ClusterBudget(args.max_path_num,
+                                 args.max_path_memory,
+                                 args.max_cluster_time),
+                   args.best_first_search,
+                   args.parallel_cluster_size,
+                   args.split_clusters,
+                   args.exact_prepass);
 
     // if(args.direct_match){
     //     for(int i = 0; i < args.query_file_list.size(); i++){
@@ -180,6 +279,21 @@ int main(int argc, char* argv[])
     //     }
     //     return 0;
     // }
+    if(args.bed_filename != ""){
+        if(!wg.ReadBedRegions(args.bed_filename)) return 1;
+    }
+    if(args.shard != ""){
+        vector<string> shard_columns = split(args.shard, '/');
+        if(shard_columns.size() != 2 || !wg.SetShard(atoi(shard_columns[0].c_str()), atoi(shard_columns[1].c_str()))){
+            cout << "[VarMatch] Error: --shard should be i/N with 0 <= i < N" << endl;
+            return 1;
+        }
+    }
+    if(args.region_list.size() > 0 || args.region_filename != ""){
+        if(!wg.SetTargetRegions(args.region_list, args.region_filename)) return 1;
+    }
+    wg.SetNumaReplicas(args.numa);
+
     if(args.score_scheme == 3){
         wg.ReadDirectRef(args.genome_seq_filename, 
             args.ref_vcf_filename);
@@ -188,19 +302,33 @@ int main(int argc, char* argv[])
             args.ref_vcf_filename);
     }
 
-    // use a loop 
+    if(args.score_scheme == 3){
+        vector<string> output_prefix_list;
+        for(int i = 0; i < args.query_file_list.size(); i++){
+            output_prefix_list.push_back("query"+to_string(i+1));
+        }
+        bool matched = wg.DirectMatch(args.query_file_list,
+            output_prefix_list,
+            args.score_unit,
+            args.match_mode);
+        return matched ? 0 : 1;
+    }
+
+    // use a loop, a query that can not be read does not stop the others
+    bool all_matched = true;
     for(int i = 0; i < args.query_file_list.size(); i++){
         string query_filename = args.query_file_list[i];
 
-        wg.Compare(query_filename,
+        bool matched = wg.Compare(query_filename,
             "query"+to_string(i+1),
             args.detail_results,
             args.score_unit,
             args.match_mode,
             args.score_scheme);
+        if(!matched) all_matched = false;
     }
 
-    return 0;
+    return all_matched ? 0 : 1;
 
 //
 //    if(args.remove_duplicates){
@@ -0,0 +1,470 @@
+#include <tclap/CmdLine.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include "varmatch.h"
+#include "util.h"
+
+using namespace std;
+
+// keeps genomes and baselines loaded and matches query VCF files sent as requests,
+// one request per line, over a Unix socket or stdin.
+//
+//   load NAME GENOME_FASTA BASELINE_VCF
+//   match NAME QUERY_VCF [OUTPUT_DIR]
+//   unload NAME
+//   list
+//   quit       (closes the connection, or ends the server on stdin)
+//   shutdown
+//
+// every request is answered by zero or more lines and a last line starting with "ok" or "error".
+// match answers one "stat" line per mode in .stat format, .stat and .match files are written to
+// OUTPUT_DIR when given. matches of one baseline run one after another, matches of different
+// baselines run at the same time, at most --jobs of them, on one thread pool
+
+typedef struct Args {
+    string socket_path;
+    string genome_seq_filename;
+    string ref_vcf_filename;
+    int thread_num;
+    int job_num;
+    int score_unit;
+    int match_mode;
+    int score_scheme;
+    bool pr_curves;
+    bool best_first_search;
+    bool split_clusters;
+    bool exact_prepass;
+    bool pin_threads;
+    bool numa;
+}Args;
+
+bool TclapParser(Args & args, int argc, char** argv){
+    string version = "0.9";
+
+    try {
+        std::string desc = "Please cite our paper if you are using this program in your research. \n";
+        TCLAP::CmdLine cmd(desc, ' ', version);
+
+        int max_cores = (int)thread::hardware_concurrency();
+        if(max_cores <= 0) max_cores = 1;
+
+        TCLAP::ValueArg<std::string> arg_socket_path("", "socket", "Unix socket path to listen on, requests are read from stdin when not given", false, "", "file");
+        TCLAP::ValueArg<std::string> arg_genome_seq_filename("g", "genome_sequence", "genome sequence FASTA file loaded at start with -b, as baseline \"default\"", false, "", "file");
+        TCLAP::ValueArg<std::string> arg_baseline_vcf_filename("b", "baseline", "baseline variant VCF file loaded at start with -g", false, "", "file");
+        TCLAP::ValueArg<int> arg_thread_num("t", "thread_num", "number of threads shared by all jobs, default is the number of available cores", false, max_cores, "int");
+        TCLAP::ValueArg<int> arg_job_num("", "jobs", "number of matches run at the same time, each with thread_num/jobs threads (Default: 1)", false, 1, "int");
+        vector<int> allowed_two = {-1, 0,1};
+        TCLAP::ValuesConstraint<int> allowedVals(allowed_two);
+        TCLAP::ValueArg<int> arg_score_unit("u", "score_unit", "score unit, as in vm-core (Default: -1)", false, -1, &allowedVals);
+        TCLAP::ValueArg<int> arg_match_mode("m", "match_mode", "matching mode, as in vm-core (Default: -1)", false, -1, &allowedVals);
+        vector<int> allowed_four = {-1,0,1,2,3};
+        TCLAP::ValuesConstraint<int> allowedFour(allowed_four);
+        TCLAP::ValueArg<int> arg_score_scheme("s", "score_scheme", "scoring scheme, as in vm-core (Default: -1)", false, -1, &allowedFour);
+        TCLAP::SwitchArg arg_disable_curves("C", "disable_curves", "Disable Precision-Recall curves. \n", cmd, false);
+        TCLAP::SwitchArg arg_best_first("", "best_first", "use best-first search, as in vm-core", cmd, false);
+        TCLAP::SwitchArg arg_split_clusters("", "split_clusters", "split clusters at gaps, as in vm-core", cmd, false);
+        TCLAP::SwitchArg arg_exact_prepass("", "exact_prepass", "match identical variants before clustering, as in vm-core", cmd, false);
+        TCLAP::SwitchArg arg_pin_threads("", "pin_threads", "pin threads to cpus, as in vm-core", cmd, false);
+        TCLAP::SwitchArg arg_numa("", "numa", "copy genomes to every NUMA node, as in vm-core", cmd, false);
+
+        cmd.add(arg_score_scheme);
+        cmd.add(arg_match_mode);
+        cmd.add(arg_score_unit);
+        cmd.add(arg_job_num);
+        cmd.add(arg_thread_num);
+        cmd.add(arg_baseline_vcf_filename);
+        cmd.add(arg_genome_seq_filename);
+        cmd.add(arg_socket_path);
+
+        cmd.parse(argc, argv);
+
+        args.socket_path = arg_socket_path.getValue();
+        args.genome_seq_filename = arg_genome_seq_filename.getValue();
+        args.ref_vcf_filename = arg_baseline_vcf_filename.getValue();
+        args.thread_num = arg_thread_num.getValue();
+        if(args.thread_num <= 0 || args.thread_num > max_cores) args.thread_num = max_cores;
+        args.job_num = arg_job_num.getValue();
+        if(args.job_num <= 0) args.job_num = 1;
+        if(args.job_num > args.thread_num) args.job_num = args.thread_num;
+        args.score_unit = arg_score_unit.getValue();
+        args.match_mode = arg_match_mode.getValue();
+        args.score_scheme = arg_score_scheme.getValue();
+        args.pr_curves = ! arg_disable_curves.getValue();
+        args.best_first_search = arg_best_first.getValue();
+        args.split_clusters = arg_split_clusters.getValue();
+        args.exact_prepass = arg_exact_prepass.getValue();
+        args.pin_threads = arg_pin_threads.getValue();
+        args.numa = arg_numa.getValue();
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << "\n";
+        abort();
+    }
+    return true;
+}
+
+// one loaded genome and baseline, matches on it are serialized by its mutex
+typedef struct Baseline {
+    Baseline(VarMatch * var_match_ = NULL,
+    string genome_seq_filename_ = "",
+    string ref_vcf_filename_ = "") :
+    var_match(var_match_),
+    genome_seq_filename(genome_seq_filename_),
+    ref_vcf_filename(ref_vcf_filename_),
+    match_num(0){}
+
+    ~Baseline(){
+        delete var_match;
+    }
+
+    VarMatch * var_match;
+    string genome_seq_filename;
+    string ref_vcf_filename;
+    int match_num;
+    mutex match_mutex;
+}Baseline;
+
+class Server
+{
+private:
+    Args args;
+    VarMatchOptions options;
+
+    // baselines are shared so that an unloaded one is freed after the match running on it
+    map<string, shared_ptr<Baseline> > baseline_by_name;
+    mutex baseline_mutex;
+
+    int free_job_num;
+    mutex job_mutex;
+    condition_variable job_condition;
+
+    int listen_fd;
+    atomic<bool> shutting_down;
+
+    // connection threads by id, finished ones are joined when the next connection is accepted
+    // and all of them before ServeSocket returns
+    map<int, thread> connection_threads;
+    vector<int> finished_connection_ids;
+    set<int> connection_fds;
+    int next_connection_id;
+    mutex connection_mutex;
+
+    shared_ptr<Baseline> FindBaseline(string name);
+    string Load(string name, string genome_seq_filename, string ref_vcf_filename);
+    string Match(string name, string query_vcf_filename, string output_dir);
+    string Unload(string name);
+    string List();
+    void ServeConnection(int fd, int connection_id);
+    void JoinFinishedConnections();
+
+public:
+    Server(const Args & args_);
+    string HandleRequest(string line, bool & quit);
+    int ServeStdin(ostream & reply_stream);
+    int ServeSocket();
+};
+
+Server::Server(const Args & args_){
+    args = args_;
+    options.thread_num = max(1, args.thread_num / args.job_num);
+    options.score_unit = args.score_unit;
+    options.match_mode = args.match_mode;
+    options.score_scheme = args.score_scheme;
+    options.pr_curves = args.pr_curves;
+    options.best_first_search = args.best_first_search;
+    options.split_clusters = args.split_clusters;
+    options.exact_prepass = args.exact_prepass;
+    options.pin_threads = args.pin_threads;
+    options.numa = args.numa;
+    free_job_num = args.job_num;
+    listen_fd = -1;
+    shutting_down = false;
+    next_connection_id = 0;
+}
+
+shared_ptr<Baseline> Server::FindBaseline(string name){
+    lock_guard<mutex> lock(baseline_mutex);
+    auto it = baseline_by_name.find(name);
+    if(it == baseline_by_name.end()) return shared_ptr<Baseline>();
+    return it->second;
+}
+
+string Server::Load(string name, string genome_seq_filename, string ref_vcf_filename){
+    if(FindBaseline(name)) return "error " + name + " is already loaded\n";
+    if(!FileExists(genome_seq_filename)) return "error can not open " + genome_seq_filename + "\n";
+    if(!FileExists(ref_vcf_filename)) return "error can not open " + ref_vcf_filename + "\n";
+
+    // loading is not counted as a job, matches of other baselines go on meanwhile
+    shared_ptr<Baseline> baseline(new Baseline(new VarMatch(options), genome_seq_filename, ref_vcf_filename));
+    if(!baseline->var_match->Load(genome_seq_filename, ref_vcf_filename)){
+        return "error can not load " + name + "\n";
+    }
+    lock_guard<mutex> lock(baseline_mutex);
+    if(baseline_by_name.find(name) != baseline_by_name.end()) return "error " + name + " is already loaded\n";
+    baseline_by_name[name] = baseline;
+    return "ok load " + name + "\n";
+}
+
+string Server::Match(string name, string query_vcf_filename, string output_dir){
+    shared_ptr<Baseline> baseline = FindBaseline(name);
+    if(!baseline) return "error " + name + " is not loaded\n";
+
+    lock_guard<mutex> match_lock(baseline->match_mutex);
+    {
+        unique_lock<mutex> lock(job_mutex);
+        job_condition.wait(lock, [this]{ return free_job_num > 0; });
+        free_job_num--;
+    }
+
+    auto begin = chrono::steady_clock::now();
+    string reply = "";
+    auto stat_callback = [&reply](const VarMatchStat & stat){
+        string threshold_string = "";
+        string baseline_match_num_string = "";
+        string query_match_num_string = "";
+        string query_total_num_string = "";
+        for(int t = 0; t < stat.thresholds.size(); t++){
+            if(t > 0){
+                threshold_string += ",";
+                baseline_match_num_string += ",";
+                query_match_num_string += ",";
+                query_total_num_string += ",";
+            }
+            threshold_string += to_string(stat.thresholds[t]);
+            baseline_match_num_string += to_string(stat.baseline_match_num[t]);
+            query_match_num_string += to_string(stat.query_match_num[t]);
+            query_total_num_string += to_string(stat.query_total_num_by_threshold[t]);
+        }
+        reply += "stat\t" + to_string(stat.score_unit) + "\t" + to_string(stat.match_mode) + "\t" +
+                 to_string(stat.score_scheme) + "\t" + threshold_string + "\t" + baseline_match_num_string + "\t" +
+                 query_match_num_string + "\t" + query_total_num_string + "\n";
+    };
+    baseline->match_num++;
+    baseline->var_match->SetOutputDir(output_dir);
+    bool matched = baseline->var_match->MatchFile(query_vcf_filename,
+                                                  MatchRecordCallback(),
+                                                  stat_callback,
+                                                  "query" + to_string(baseline->match_num));
+    baseline->var_match->SetOutputDir("");
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    {
+        lock_guard<mutex> lock(job_mutex);
+        free_job_num++;
+    }
+    job_condition.notify_all();
+
+    if(!matched) return "error can not match " + query_vcf_filename + "\n";
+    return reply + "ok match " + name + " " + to_string(seconds) + "\n";
+}
+
+string Server::Unload(string name){
+    lock_guard<mutex> lock(baseline_mutex);
+    auto it = baseline_by_name.find(name);
+    if(it == baseline_by_name.end()) return "error " + name + " is not loaded\n";
+    baseline_by_name.erase(it);
+    return "ok unload " + name + "\n";
+}
+
+string Server::List(){
+    lock_guard<mutex> lock(baseline_mutex);
+    string reply = "";
+    for(auto it = baseline_by_name.begin(); it != baseline_by_name.end(); ++it){
+        reply += "baseline\t" + it->first + "\t" + it->second->genome_seq_filename + "\t" + it->second->ref_vcf_filename + "\n";
+    }
+    return reply + "ok list " + to_string(baseline_by_name.size()) + "\n";
+}
+
+string Server::HandleRequest(string line, bool & quit){
+    quit = false;
+    if(!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+    vector<string> columns;
+    vector<string> words = split(line, ' ');
+    for(int i = 0; i < words.size(); i++){
+        if(!words[i].empty()) columns.push_back(words[i]);
+    }
+    if(columns.size() == 0) return "";
+    // requests read after shutdown started are not run, the server is waiting for running ones only
+    if(shutting_down){
+        quit = true;
+        return "error server is shutting down\n";
+    }
+
+    string command = columns[0];
+    if(command == "load" && columns.size() == 4){
+        return Load(columns[1], columns[2], columns[3]);
+    }else if(command == "match" && (columns.size() == 3 || columns.size() == 4)){
+        return Match(columns[1], columns[2], columns.size() == 4 ? columns[3] : "");
+    }else if(command == "unload" && columns.size() == 2){
+        return Unload(columns[1]);
+    }else if(command == "list" && columns.size() == 1){
+        return List();
+    }else if(command == "quit" && columns.size() == 1){
+        quit = true;
+        return "ok quit\n";
+    }else if(command == "shutdown" && columns.size() == 1){
+        quit = true;
+        shutting_down = true;
+        return "ok shutdown\n";
+    }
+    return "error unknown request: " + line + "\n";
+}
+
+// requests are answered one after another, engine messages go to stderr
+int Server::ServeStdin(ostream & reply_stream){
+    string line;
+    while(getline(cin, line)){
+        bool quit = false;
+        reply_stream << HandleRequest(line, quit) << flush;
+        if(quit) break;
+    }
+    return 0;
+}
+
+bool WriteAll(int fd, const string & s){
+    size_t written = 0;
+    while(written < s.size()){
+        ssize_t n = write(fd, s.data() + written, s.size() - written);
+        if(n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+// requests of one connection are answered in order, connections are served at the same time
+void Server::ServeConnection(int fd, int connection_id){
+    string buffer = "";
+    char data[4096];
+    bool quit = false;
+    while(!quit){
+        size_t newline_pos = buffer.find('\n');
+        if(newline_pos == string::npos){
+            ssize_t n = read(fd, data, sizeof(data));
+            if(n <= 0) break;
+            buffer.append(data, n);
+            continue;
+        }
+        string line = buffer.substr(0, newline_pos);
+        buffer.erase(0, newline_pos + 1);
+        if(!WriteAll(fd, HandleRequest(line, quit))) break;
+    }
+    lock_guard<mutex> lock(connection_mutex);
+    connection_fds.erase(fd);
+    close(fd);
+    // the answer to shutdown is sent before accept is stopped
+    if(shutting_down && listen_fd >= 0) shutdown(listen_fd, SHUT_RDWR);
+    finished_connection_ids.push_back(connection_id);
+}
+
+// called with connection_mutex held, finished threads no longer need it
+void Server::JoinFinishedConnections(){
+    for(int i = 0; i < finished_connection_ids.size(); i++){
+        auto it = connection_threads.find(finished_connection_ids[i]);
+        it->second.join();
+        connection_threads.erase(it);
+    }
+    finished_connection_ids.clear();
+}
+
+int Server::ServeSocket(){
+    struct sockaddr_un address;
+    if(args.socket_path.size() >= sizeof(address.sun_path)){
+        cout << "[VarMatch] Error: socket path is too long" << endl;
+        return 1;
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd < 0){
+        cout << "[VarMatch] Error: can not create socket" << endl;
+        return 1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, args.socket_path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(args.socket_path.c_str());
+    if(::bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0){
+        cout << "[VarMatch] Error: can not listen on " << args.socket_path << endl;
+        close(listen_fd);
+        return 1;
+    }
+    cout << "[VarMatch] listening on " << args.socket_path << endl;
+
+    while(!shutting_down){
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR) continue;
+            break;
+        }
+        lock_guard<mutex> lock(connection_mutex);
+        JoinFinishedConnections();
+        connection_fds.insert(fd);
+        int connection_id = next_connection_id++;
+        connection_threads[connection_id] = thread(&Server::ServeConnection, this, fd, connection_id);
+    }
+    shutting_down = true;
+
+    // loads and matches still running are finished, idle connections stop reading,
+    // and every request read later is refused
+    map<int, thread> remaining_threads;
+    {
+        lock_guard<mutex> lock(connection_mutex);
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(args.socket_path.c_str());
+        for(auto it = connection_fds.begin(); it != connection_fds.end(); ++it){
+            shutdown(*it, SHUT_RD);
+        }
+        remaining_threads.swap(connection_threads);
+        finished_connection_ids.clear();
+    }
+    for(auto it = remaining_threads.begin(); it != remaining_threads.end(); ++it){
+        it->second.join();
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+
+    Args args;
+    TclapParser(args, argc, argv);
+
+    // a client leaving before its answer must not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // on stdin, answers keep stdout and everything else goes to stderr
+    streambuf * stdout_buffer = cout.rdbuf();
+    ostream reply_stream(stdout_buffer);
+    if(args.socket_path == "") cout.rdbuf(cerr.rdbuf());
+
+    Server server(args);
+    if(args.genome_seq_filename != "" || args.ref_vcf_filename != ""){
+        bool quit = false;
+        string reply = server.HandleRequest("load default " + args.genome_seq_filename + " " + args.ref_vcf_filename, quit);
+        if(reply.compare(0, 2, "ok") != 0){
+            cerr << reply;
+            cout.rdbuf(stdout_buffer);
+            return 1;
+        }
+    }
+
+    int result = 0;
+    if(args.socket_path == ""){
+        result = server.ServeStdin(reply_stream);
+    }else{
+        result = server.ServeSocket();
+    }
+    cout.rdbuf(stdout_buffer);
+    return result;
+}
@@ -1,16 +1,43 @@
 #include "wholegenome.h"
+#include "threadpool.h"
 
 using namespace std;
 
 // constructor
 WholeGenome::WholeGenome(int thread_num_,
     string output_dir_,
-    bool pr_curves){
+    bool pr_curves,
+    bool cluster_report_,
+    int report_top_num_,
+    ClusterBudget cluster_budget_,
+    bool best_first_search_,
+    int parallel_cluster_size_,
+    bool split_clusters_,
+    bool exact_prepass_){
 
     thread_num = thread_num_;
     chrom_num = 24;
 
     output_dir = output_dir_;
+    cluster_report = cluster_report_;
+    report_top_num = report_top_num_;
+    cluster_budget = cluster_budget_;
+    best_first_search = best_first_search_;
+    parallel_cluster_size = parallel_cluster_size_;
+    direct_match = false;
+    score_unit_indicator = -1;
+    match_mode_indicator = -1;
+    score_scheme_indicator = -1;
+    expand_paths_in_parallel = false;
+    split_clusters = split_clusters_;
+    exact_prepass = exact_prepass_;
+    shard_index = 0;
+    shard_num = 1;
+    largest_cluster_before_split = 0;
+    split_cluster_num = 0;
+    write_result_files = true;
+    query_lines = NULL;
+    numa_replicas = false;
 
     //thread_num = thread_num_;
     //dout << "WholeGenome() Thread Number: " << thread_num << endl;
@@ -67,6 +94,9 @@ WholeGenome::~WholeGenome(){
     }
     delete[] ref_variant_by_chrid;
     delete[] que_variant_by_chrid;
+    for(int i = 0; i < genome_replicas.size(); i++){
+        delete genome_replicas[i];
+    }
 }
 
 bool WholeGenome::ReadWholeGenomeSequence(string filename){
@@ -142,13 +172,46 @@ bool WholeGenome::ReadGenomeSequenceList(string filename){
 }
 
 int WholeGenome::ReadWholeGenomeVariant(string filename, bool flag){
+    vector<DiploidVariant> ** variant_by_chrid = ref_variant_by_chrid;
+    vector<string> * variant_strings = NULL;
+    if(flag){
+        variant_by_chrid = que_variant_by_chrid;
+        variant_strings = &query_variant_strings;
+    }
+    int total_num = ReadWholeGenomeVariant(filename,
+                                           flag,
+                                           variant_by_chrid,
+                                           match_mode_indicator,
+                                           threshold_list,
+                                           per_list,
+                                           variant_strings);
+    if(flag){
+        threshold_num = threshold_list.size();
+    }
+    return total_num;
+}
+
+// variants, thresholds and match mode go to the given storage so that several queries can be read at once
+int WholeGenome::ReadWholeGenomeVariant(string filename,
+                                        bool flag,
+                                        vector<DiploidVariant> ** variant_by_chrid,
+                                        int & match_mode_indicator,
+                                        vector<double> & threshold_list,
+                                        vector<float> & per_list,
+                                        vector<string> * variant_strings){
     int total_num = 0;
     int long_num = 0;
     double QUAL_LOWER_BOUND = 0.1;
 
-	ifstream vcf_file;
-	vcf_file.open(filename.c_str());
-	if (!vcf_file.good()) {
+	VcfReader vcf_file;
+	bool opened = false;
+	if (flag && query_lines != NULL) {
+		opened = vcf_file.OpenLines(query_lines);
+	}
+	else {
+		opened = vcf_file.Open(filename, target_regions);
+	}
+	if (!opened) {
 		cout << "[VarMatch] Error: can not open vcf file" << endl;
 		return -1;
 	}
@@ -158,9 +221,8 @@ int WholeGenome::ReadWholeGenomeVariant(string filename, bool flag){
 	int genotype_index = -1;
 	char genotype_separator = '/';
 	//int genome_sequence_length = genome_sequence.length();
-	while (!vcf_file.eof()) { // alternative way is vcf_file != NULL
-		string line;
-		getline(vcf_file, line, '\n');
+	string line;
+	while (vcf_file.ReadLine(line)) {
 		// check ineligible lines
 		//dout << line << endl;
 		if ((int)line.length() <= 1) continue;
@@ -185,6 +247,8 @@ int WholeGenome::ReadWholeGenomeVariant(string filename, bool flag){
 		}
 		string chr_name = columns[0];
 		auto pos = atoi(columns[1].c_str()) - 1; // 0-based coordinate
+        if(!bed_regions_by_chrname.empty() && !InBedRegions(chr_name, pos)) continue;
+        if(!target_regions_by_chrname.empty() && !InTargetRegions(chr_name, pos)) continue;
 
 		auto ref = columns[3];
 		auto alt_line = columns[4];
@@ -300,36 +364,32 @@ int WholeGenome::ReadWholeGenomeVariant(string filename, bool flag){
         }
 
 		DiploidVariant dv(pos, ref, alt_list, is_heterozygous_variant, is_multi_alternatives, snp_del, snp_ins, flag, quality, is_zero_one_var);
+		// direct matching compares alleles as strings
+		if(!direct_match) CompileAltVectors(dv);
 		//if (normalization) {
 			//NormalizeDiploidVariant(dv);
 		//}
-        if(chrid_by_chrname.find(chr_name) != chrid_by_chrname.end()){
-            int chr_id = chrid_by_chrname[chr_name];
-            if(flag == false){
-                ref_variant_by_chrid[chr_id]->push_back(dv);
-                //baseline_variant_strings.push_back(line);
-            }else{
-                que_variant_by_chrid[chr_id]->push_back(dv);
-                query_variant_strings.push_back(line);
+        auto chr_it = chrid_by_chrname.find(chr_name);
+        if(chr_it != chrid_by_chrname.end()){
+            int chr_id = chr_it->second;
+            variant_by_chrid[chr_id]->push_back(dv);
+            if(variant_strings != NULL){
+                variant_strings->push_back(line);
             }
         }else{
             cout << "[VarMatch] skip current variant as no corresponding reference genome sequence found." << endl;
             continue;
-            int chr_id = chrname_dict[chr_name];
-            if(flag == false){
-                ref_variant_by_chrid[chr_id]->push_back(dv);
-                //baseline_variant_strings.push_back(line);
-            }else{
-                que_variant_by_chrid[chr_id]->push_back(dv);
-                query_variant_strings.push_back(line);
-            }
         }
 
         total_num++;
 	}
-	vcf_file.close();
+	vcf_file.Close();
 
-    if(flag){
+    if(flag && quality_list.size() == 0){
+        // no query variant, e.g. none in the given regions
+        threshold_list.push_back(0.0);
+        per_list = {0.0};
+    }else if(flag){
         sort(quality_list.begin(), quality_list.end());
         auto qual_lower_it = lower_bound(quality_list.begin(), quality_list.end(), QUAL_LOWER_BOUND);
         int qual_lower_index = qual_lower_it - quality_list.begin();
@@ -355,7 +415,6 @@ int WholeGenome::ReadWholeGenomeVariant(string filename, bool flag){
             double percentage = (double)quality_size/ quality_list.size();
             temp_percentage_list.push_back(percentage);
         }
-        threshold_num = threshold_list.size();
         // revice percentage
         per_list = temp_percentage_list;
     }
@@ -363,6 +422,166 @@ int WholeGenome::ReadWholeGenomeVariant(string filename, bool flag){
 	return total_num;
 }
 
+void SortMergeIntervals(vector<Interval> & intervals){
+    sort(intervals.begin(), intervals.end(), [](const Interval & a, const Interval & b){ return a.start < b.start; });
+    vector<Interval> merged_intervals;
+    for(int i = 0; i < intervals.size(); i++){
+        if(merged_intervals.size() > 0 && intervals[i].start <= merged_intervals.back().end){
+            merged_intervals.back().end = max(merged_intervals.back().end, intervals[i].end);
+        }else{
+            merged_intervals.push_back(intervals[i]);
+        }
+    }
+    intervals.swap(merged_intervals);
+}
+
+// intervals are sorted, merged and half-open
+bool PositionInIntervals(const vector<Interval> & intervals, int pos){
+    auto it = upper_bound(intervals.begin(), intervals.end(), pos, [](int p, const Interval & r){ return p < r.start; });
+    if(it == intervals.begin()) return false;
+    --it;
+    return pos < it->end;
+}
+
+// confident regions, kept sorted and merged per chromosome. variants are tested by their start position,
+// the same way for baseline and query, so a cluster only holds variants starting inside regions
+bool WholeGenome::ReadBedRegions(string filename){
+    ifstream bed_file(filename.c_str());
+    if(!bed_file.good()){
+        cout << "[VarMatch] Error: can not open bed file " << filename << endl;
+        return false;
+    }
+    bed_regions_by_chrname.clear();
+    string line;
+    int region_num = 0;
+    while(getline(bed_file, line).good()){
+        if(line.empty() || line[0] == '#') continue;
+        if(line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0) continue;
+        vector<string> columns = split(line, '\t');
+        if(columns.size() < 3) continue;
+        bed_regions_by_chrname[columns[0]].push_back(Interval(stoi(columns[1]), stoi(columns[2])));
+        region_num++;
+    }
+    for(auto it = bed_regions_by_chrname.begin(); it != bed_regions_by_chrname.end(); ++it){
+        SortMergeIntervals(it->second);
+    }
+    cout << "[VarMatch] read " << region_num << " regions on " << bed_regions_by_chrname.size() << " chromosomes from " << filename << endl;
+    return true;
+}
+
+// 0-based pos is inside a half-open bed region, chromosomes without regions are not restricted, as filter_hc does
+bool WholeGenome::InBedRegions(const string & chr_name, int pos){
+    auto it = bed_regions_by_chrname.find(chr_name);
+    if(it == bed_regions_by_chrname.end()) return true;
+    return PositionInIntervals(it->second, pos);
+}
+
+bool WholeGenome::SetShard(int shard_index_, int shard_num_){
+    if(shard_num_ < 1 || shard_index_ < 0 || shard_index_ >= shard_num_) return false;
+    shard_index = shard_index_;
+    shard_num = shard_num_;
+    return true;
+}
+
+// regions given with --region, variants on other chromosomes are dropped.
+// with a .tbi or .csi index next to a bgzipped VCF only blocks of these regions are read
+bool WholeGenome::SetTargetRegions(vector<string> region_strings, string region_filename){
+    if(region_filename != ""){
+        ifstream region_file(region_filename.c_str());
+        if(!region_file.good()){
+            cout << "[VarMatch] Error: can not open region file " << region_filename << endl;
+            return false;
+        }
+        string line;
+        while(getline(region_file, line).good()){
+            if(line.empty() || line[0] == '#') continue;
+            vector<string> columns = split(line, '\t');
+            if(columns.size() >= 3){
+                // BED line, already 0-based half-open
+                region_strings.push_back(columns[0] + ":" + to_string(stoi(columns[1])+1) + "-" + columns[2]);
+            }else{
+                region_strings.push_back(columns[0]);
+            }
+        }
+    }
+    target_regions.clear();
+    target_regions_by_chrname.clear();
+    for(int i = 0; i < region_strings.size(); i++){
+        GenomeRegion region;
+        if(!ParseGenomeRegion(region_strings[i], region)){
+            cout << "[VarMatch] Error: can not parse region " << region_strings[i] << endl;
+            return false;
+        }
+        target_regions.push_back(region);
+        int end = region.end < 0 ? numeric_limits<int>::max() : region.end;
+        target_regions_by_chrname[region.chr_name].push_back(Interval(region.start, end));
+    }
+    for(auto it = target_regions_by_chrname.begin(); it != target_regions_by_chrname.end(); ++it){
+        SortMergeIntervals(it->second);
+    }
+    return true;
+}
+
+bool WholeGenome::InTargetRegions(const string & chr_name, int pos){
+    auto it = target_regions_by_chrname.find(chr_name);
+    if(it == target_regions_by_chrname.end()) return false;
+    return PositionInIntervals(it->second, pos);
+}
+
+// only chromosomes with target regions are read, through the .fai index. bases outside regions and
+// their padding are left as N, positions stay the same as in the whole chromosome
+bool WholeGenome::ReadGenomeRegions(string filename){
+    ifstream fai_file((filename + ".fai").c_str());
+    ifstream fasta_file(filename.c_str(), ios::binary);
+    if(!fai_file.good() || !fasta_file.good()) return false;
+
+    string line;
+    int chr_id = 0;
+    while(getline(fai_file, line).good()){
+        vector<string> columns = split(line, '\t');
+        if(columns.size() < 5) continue;
+        string name = columns[0];
+        auto region_it = target_regions_by_chrname.find(name);
+        if(region_it == target_regions_by_chrname.end()) continue;
+        if(chrname_dict.find(name) == chrname_dict.end()){
+            cout << "[VarMatch] Error: detected chromosome name: " << name <<" does not exist in human genome." << endl;
+            return false;
+        }
+        long long sequence_length = stoll(columns[1]);
+        long long sequence_offset = stoll(columns[2]);
+        long long line_bases = stoll(columns[3]);
+        long long line_width = stoll(columns[4]);
+
+        string content(sequence_length, 'N');
+        vector<Interval> & regions = region_it->second;
+        for(int i = 0; i < regions.size(); i++){
+            long long start = max(0LL, (long long)regions[i].start - REGION_PADDING);
+            long long end = min(sequence_length, (long long)regions[i].end + REGION_PADDING);
+            if(start >= end) continue;
+            long long file_start = sequence_offset + start / line_bases * line_width + start % line_bases;
+            long long file_end = sequence_offset + (end-1) / line_bases * line_width + (end-1) % line_bases + 1;
+            string raw(file_end - file_start, '\0');
+            fasta_file.seekg(file_start);
+            fasta_file.read(&raw[0], raw.size());
+            long long k = start;
+            for(int j = 0; j < raw.size() && k < end; j++){
+                if(raw[j] == '\n' || raw[j] == '\r') continue;
+                content[k++] = raw[j];
+            }
+        }
+        chrid_by_chrname[name] = chr_id;
+        chrname_by_chrid[chr_id] = name;
+        genome_sequences[chr_id] = content;
+        chr_id++;
+    }
+    if(chr_id > chrom_num){
+        cout << "[VarMatch] Error: too many chromosomes in regions" << endl;
+        return false;
+    }
+    chrom_num = chr_id;
+    return true;
+}
+
 bool WholeGenome::ReadVariantFileList(string filename){
 
 }
@@ -534,35 +753,40 @@ void WholeGenome::GenerateAltVector(string ref, string alt, vector<string> & alt
     return;
 }
 
+// align ref against each alt once at load, paths only copy the per reference base spans
+void WholeGenome::CompileAltVectors(DiploidVariant & dv){
+    dv.alt_vectors.clear();
+    for(int i = 0; i < dv.alts.size(); i++){
+        vector<string> alt_vector;
+        GenerateAltVector(dv.ref, dv.alts[i], alt_vector);
+        dv.alt_vectors.push_back(alt_vector);
+    }
+}
+
 bool WholeGenome::ParallelClustering(){
     // parallel by chr
     variant_cluster_by_chrid = new vector<vector<VariantIndicator>> *[chrom_num];
     for (int j = 0; j < chrom_num; j++) {
         variant_cluster_by_chrid[j] = new vector<vector<VariantIndicator>>;
     }
-
-    int parallel_steps = chrom_num / thread_num;
-    if(parallel_steps*thread_num < chrom_num) parallel_steps += 1;
-    int chr_id = 0;
-    for(int i = 0; i < parallel_steps; i++){
-        vector<thread> threads;
-        for(int j = 0; j < thread_num-1 && chr_id < chrom_num-1; j++){
-            if(chrname_by_chrid.find(chr_id) != chrname_by_chrid.end()){
-                if(ref_variant_by_chrid[chr_id]->size() > 0 && que_variant_by_chrid[chr_id]->size() > 0){
-                    threads.push_back(thread(&WholeGenome::SingleThreadClustering, this, chr_id));
-                }
-            }
-            chr_id ++;
-        }
-        if(chr_id < chrom_num){
-            if(chrname_by_chrid.find(chr_id) != chrname_by_chrid.end()){
-                SingleThreadClustering(chr_id);
-            }
-            chr_id ++;
+    largest_cluster_before_split_by_chrid.assign(chrom_num, 0);
+    split_cluster_num_by_chrid.assign(chrom_num, 0);
+    exact_match_records_by_chrid.assign(chrom_num, vector<string>());
+    exact_match_num_by_chrid.assign(chrom_num, vector<int>(threshold_num, 0));
+    exact_edit_distance_by_chrid.assign(chrom_num, vector<int>(threshold_num, 0));
+
+    // chromosomes are taken one at a time by pool threads, a thread done with a small chromosome
+    // does not wait for the others before taking the next one
+    vector<int> cluster_chr_ids;
+    for(int chr_id = 0; chr_id < chrom_num; chr_id++){
+        if(chrname_by_chrid.find(chr_id) == chrname_by_chrid.end()) continue;
+        if(ref_variant_by_chrid[chr_id]->size() > 0 && que_variant_by_chrid[chr_id]->size() > 0){
+            cluster_chr_ids.push_back(chr_id);
         }
-        std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
-        threads.clear();
     }
+    ThreadPool::Shared().ParallelFor(cluster_chr_ids.size(), [&](int i){
+        SingleThreadClustering(cluster_chr_ids[i]);
+    }, thread_num);
 
 
     for(int i = 0; i < chrom_num; i++){
@@ -571,36 +795,36 @@ bool WholeGenome::ParallelClustering(){
         }
     }
 
-    // test output
-    //dout << endl;
-    map<int, int> size_num;
-    map<int, int> size_chrid;
+    // cluster size histogram, kept for the cluster report
+    cluster_size_num.clear();
+    cluster_size_chrid.clear();
     for(int i = 0; i < chrom_num; i++){
         //dout << i << ": " << variant_cluster_by_chrid[i]->size() << endl;
         for(int j = 0; j < variant_cluster_by_chrid[i]->size(); j++){
             int temp_size = variant_cluster_by_chrid[i]->at(j).size();
-            if(size_num.find(temp_size) != size_num.end()){
-                size_num[temp_size] ++;
+            if(cluster_size_num.find(temp_size) != cluster_size_num.end()){
+                cluster_size_num[temp_size] ++;
             }else{
-                size_num[temp_size] = 1;
+                cluster_size_num[temp_size] = 1;
             }
-            if(size_chrid.find(temp_size) == size_chrid.end()){
-                size_chrid[temp_size] = i;
+            if(cluster_size_chrid.find(temp_size) == cluster_size_chrid.end()){
+                cluster_size_chrid[temp_size] = i;
             }
         }
     }
 
-    //cout << endl;
-    //for(auto it = size_num.begin(); it != size_num.end(); ++it){
-    //    dout << it->first << ": " << it->second << endl;
-    //}
-
-//    cout << endl;
-//    cout << "size and location:" << endl;
-//    for(auto it = size_chrid.begin(); it != size_chrid.end(); ++it){
-//        dout << it->first << ": " << it->second << endl;
-//    }
-        // clean at the end of function
+    if(split_clusters){
+        largest_cluster_before_split = 0;
+        split_cluster_num = 0;
+        for(int i = 0; i < chrom_num; i++){
+            largest_cluster_before_split = max(largest_cluster_before_split, largest_cluster_before_split_by_chrid[i]);
+            split_cluster_num += split_cluster_num_by_chrid[i];
+        }
+        int largest_cluster = 0;
+        if(cluster_size_num.size() > 0) largest_cluster = cluster_size_num.rbegin()->first;
+        cout << "[VarMatch] split " << split_cluster_num << " clusters at forced sync points, "
+             << "largest cluster shrank from " << largest_cluster_before_split << " to " << largest_cluster << " variants" << endl;
+    }
 
     for(int j = 0; j < chrom_num; j++){
         variant_cluster_by_chrid[j]->clear();
@@ -653,21 +877,45 @@ bool WholeGenome::CheckTandemRepeat(string sequence, int unit_threshold) {
     return final_checking;
 }
 
+// record of a baseline variant identical to the only query variant of its cluster, for every mode
+void WholeGenome::AddDirectMatchRecord(int thread_index,
+                                       int threshold_index,
+                                       int chr_id,
+                                       DiploidVariant & tv){
+    string match_record = chrname_by_chrid[chr_id] + "\t" + to_string(tv.pos+1) + "\t" + tv.ref + "\t" + tv.alts[0];
+    if(tv.multi_alts) match_record += "/" + tv.alts[1];
+    match_record += "\t.\t.\t.\t.\t.\n";
+
+    int edit_distance = CalculateEditDistance(tv, 0, 0);
+    // here we need to push back for all mode_index
+    for(int mi = 0; mi < mode_index_list.size(); mi ++){
+        int mode_i = mode_index_list[mi];
+        match_records_by_mode_by_thread[thread_index][mode_i]->push_back(match_record);
+        baseline_total_match_num[thread_index][threshold_index]->at(mode_i)++;
+        query_total_match_num[thread_index][threshold_index]->at(mode_i)++;
+
+        baseline_total_edit_distance[thread_index][threshold_index]->at(mode_i) +=  edit_distance;
+        query_total_edit_distance[thread_index][threshold_index]->at(mode_i) += edit_distance;
+    }
+}
+
 // preprocess
 bool WholeGenome::MatchVariantListInThread(int thread_index, 
     int threshold_index,
     int chr_id,
     vector<DiploidVariant> & variant_list,
-    int cluster_id){
+    int cluster_id,
+    SnpClusterBatch * snp_batch){
     //===================================================
     sort(variant_list.begin(), variant_list.end());
+    const string & genome_sequence = GenomeSequence(chr_id);
     // decide reference sequence
     vector<DiploidVariant> separate_var_list[2];
     vector<Interval> intervals;
     // separate into ref and que
     int total_mil = 0;
     int total_mdl = 0;
-    int min_pos = genome_sequences[chr_id].length() + 1;
+    int min_pos = genome_sequence.length() + 1;
     int max_pos = -1;
     for (int i = 0; i < variant_list.size(); i++) {
         int flag = 0;
@@ -685,7 +933,7 @@ bool WholeGenome::MatchVariantListInThread(int thread_index,
         intervals.push_back(Interval(pos, end_pos));
     }
     min_pos = max(min_pos - 1, 0);
-    max_pos = min(max_pos + 1, (int)genome_sequences[chr_id].length()); //exclusive
+    max_pos = min(max_pos + 1, (int)genome_sequence.length()); //exclusive
 
     if (separate_var_list[0].size() == 0 || separate_var_list[1].size() == 0) {
         //dout << separate_var_list[0].size() << ", " << separate_var_list[1].size() << endl;
@@ -694,34 +942,20 @@ bool WholeGenome::MatchVariantListInThread(int thread_index,
     if (separate_var_list[0].size() == 1 && separate_var_list[1].size() == 1){
         // try direct match to save time
         if(separate_var_list[0][0] == separate_var_list[1][0]){
-
-            DiploidVariant tv = separate_var_list[0][0];
-            string match_record = chrname_by_chrid[chr_id] + "\t" + to_string(tv.pos+1) + "\t" + tv.ref + "\t" + tv.alts[0];
-            if(tv.multi_alts) match_record += "/" + tv.alts[1];
-            match_record += "\t.\t.\t.\t.\t.\n";
-            // here we need to push back for all mode_index
-            //complex_match_records[thread_index]->push_back(match_record);
-
-            int edit_distance = CalculateEditDistance(tv, 0, 0);
-            for(int mi = 0; mi < mode_index_list.size(); mi ++){
-                int mode_i = mode_index_list[mi];
-                //if(mi == 0){
-                
-
-                // this line should be recovered
-                match_records_by_mode_by_thread[thread_index][mode_i]->push_back(match_record);
-                
-                //}else{
-                //    match_records_by_mode_by_thread[thread_index][mode_i]->push_back("$"+to_string(match_records_by_mode_by_thread[thread_index][0]->size()));
-                    // use dollor to represent that it is the same
-                //}
-                baseline_total_match_num[thread_index][threshold_index]->at(mode_i)++;
-                query_total_match_num[thread_index][threshold_index]->at(mode_i)++;
-
-                baseline_total_edit_distance[thread_index][threshold_index]->at(mode_i) +=  edit_distance;
-                query_total_edit_distance[thread_index][threshold_index]->at(mode_i) += edit_distance;
-                //calculate the edit distance
+            // recorded in turn with the clusters of the batch, so that records keep cluster order
+            if(snp_batch != NULL){
+                SnpCluster direct_cluster;
+                direct_cluster.threshold_index = threshold_index;
+                direct_cluster.chr_id = chr_id;
+                direct_cluster.direct = true;
+                direct_cluster.variant_list.push_back(separate_var_list[0][0]);
+                direct_cluster.position_start = snp_batch->position_num();
+                direct_cluster.position_end = snp_batch->position_num();
+                direct_cluster.stat_index = -1;
+                snp_batch->clusters.push_back(direct_cluster);
+                return true;
             }
+            AddDirectMatchRecord(thread_index, threshold_index, chr_id, separate_var_list[0][0]);
             // output match result
             return true;
         }
@@ -771,29 +1005,28 @@ bool WholeGenome::MatchVariantListInThread(int thread_index,
         }
     }
 
-    string subsequence = genome_sequences[chr_id].substr(min_pos, max_pos - min_pos);
+    string subsequence = genome_sequence.substr(min_pos, max_pos - min_pos);
 
     ToUpper(subsequence); // subsequence only contains upper char
     int offset = min_pos;
     int subsequence_length = max_pos - min_pos;
 
-    // have subsequence in hand
-    //generate decision point
-    multimap<int, int> * choices_by_pos[2];
-    // choice by pos is to also equal to var by pos
-    for(int i = 0; i < 2; i++){
-        choices_by_pos[i] = new multimap<int, int>();
+    // clusters of SNPs only are matched position by position in batches, without extending paths
+    if(IsSnpCluster(variant_list)){
+        if(snp_batch != NULL){
+            AddSnpCluster(*snp_batch, threshold_index, chr_id, variant_list, subsequence, offset);
+        }else{
+            SnpClusterBatch single_batch;
+            AddSnpCluster(single_batch, threshold_index, chr_id, variant_list, subsequence, offset);
+            MatchSnpClusterBatch(thread_index, single_batch);
+        }
+        return true;
     }
 
-    for(int index = 0; index < variant_list.size(); index++){
-        if(!appliable_flag[index]) continue;
-        // remove decision point if not applicable
-        int pos = variant_list[index].pos - offset;
-        int flag = 0;
-        if(variant_list[index].flag) flag = 1;
-        choices_by_pos[flag]->insert(pair<int, int>(pos, index));
-        //dout << pos << index << endl;
-    }
+    // have subsequence in hand
+    //generate decision point
+    DecisionIndex decision_index;
+    BuildDecisionIndex(decision_index, variant_list, appliable_flag, offset, subsequence_length);
 
     vector<Interval> mergered_intervals = merge(intervals);
 //    unordered_map<int, bool> sync_points;
@@ -820,72 +1053,80 @@ bool WholeGenome::MatchVariantListInThread(int thread_index,
             for(int k = 0; k < score_scheme_list.size(); k++){
                 score_scheme = score_scheme_list[k];
 
-                bool method2 = MatchingSingleClusterBaseExtending(
-                                            cluster_id,
-                                            thread_index,
-                                            variant_list,
-                                            subsequence,
-                                            offset,
-                                            choices_by_pos,
-                                            sync_points,
-                                            chr_id,
-                                            score_unit,
-                                            match_mode,
-                                            score_scheme,
-                                            threshold_index);
+                // once a cluster runs out of budget, the remaining modes fall back to direct matching,
+                // then MatchClusterInThread matches every threshold of the cluster that way
+                bool budget_exceeded = current_cluster_stat_by_thread[thread_index].budget_exceeded;
+                if(!budget_exceeded && best_first_search){
+                    MatchingSingleClusterBestFirst(
+                                                cluster_id,
+                                                thread_index,
+                                                variant_list,
+                                                subsequence,
+                                                offset,
+                                                decision_index,
+                                                sync_points,
+                                                chr_id,
+                                                score_unit,
+                                                match_mode,
+                                                score_scheme,
+                                                threshold_index,
+                                                budget_exceeded);
+                }else if(!budget_exceeded){
+                    MatchingSingleClusterBaseExtending(
+                                                cluster_id,
+                                                thread_index,
+                                                variant_list,
+                                                subsequence,
+                                                offset,
+                                                decision_index,
+                                                sync_points,
+                                                chr_id,
+                                                score_unit,
+                                                match_mode,
+                                                score_scheme,
+                                                threshold_index,
+                                                budget_exceeded);
+                }
+                if(budget_exceeded){
+                    DirectMatchVariantList(thread_index,
+                                           threshold_index,
+                                           chr_id,
+                                           variant_list,
+                                           match_mode,
+                                           GetIndexFromMatchScore(score_unit, match_mode, score_scheme));
+                }
             }
         }
     }
 
-    for(int i = 0; i < 2; i++){
-        delete choices_by_pos[i];
-    }
-    //delete choices_by_pos;
-
     return true;
 }
 
 // transfer indicator to variant 
 bool WholeGenome::ClusteringMatchInThread(int start, int end, int thread_index) {
 
+    // consecutive SNP-only clusters are matched together, any other cluster is matched after them
+    SnpClusterBatch snp_batch;
 	for (int cluster_id = start; cluster_id < end; cluster_id++) {
         if(cluster_id >= variants_by_cluster.size()) break;
         //dout << cluster_id << endl;
         //bool method1 = MatchingSingleCluster(cluster_id, thread_index);
-        vector<VariantIndicator> vi_list = variants_by_cluster[cluster_id];
-        if(vi_list.size() <= 1) continue;
-        // create variant_list from vi_list;
-
-        for(int t = 0; t < threshold_num; t++){
-
-            double quality_threshold = threshold_list[t];
-
-            vector<DiploidVariant> variant_list;
-            int chr_id = -1;
-            for(int i = 0; i < vi_list.size(); i++){
-                VariantIndicator vi = vi_list[i];
-                chr_id = vi.chr_id;
-                int var_id = vi.var_id;
-                DiploidVariant var;
-                if(vi.refer){
-                    var = ref_variant_by_chrid[chr_id]->at(var_id);
-                }else{
-                    var = que_variant_by_chrid[chr_id]->at(var_id);
-                }
-                if(var.qual < quality_threshold) continue;
-                variant_list.push_back(var);
-            }
-            if(chr_id == -1 || chr_id >= chrom_num){
-                cout << "[VarMatch] Error in matching single cluster" << endl;
-                continue;
+        if(variants_by_cluster[cluster_id].size() <= 1) continue;
+        // huge clusters are matched after all threads finish, see ClusteringMatchMultiThread
+        if(parallel_cluster_size > 0 && !best_first_search &&
+           variants_by_cluster[cluster_id].size() > parallel_cluster_size){
+            MatchSnpClusterBatch(thread_index, snp_batch);
+            DeferCluster(cluster_id, thread_index);
+            continue;
+        }
+        if(IsSnpCluster(variants_by_cluster[cluster_id])){
+            MatchClusterInThread(cluster_id, thread_index, &snp_batch);
+            if(snp_batch.clusters.size() >= SnpClusterBatch::MAX_CLUSTER_NUM){
+                MatchSnpClusterBatch(thread_index, snp_batch);
             }
-
-            MatchVariantListInThread(thread_index, 
-                                    t,
-                                    chr_id,
-                                    variant_list,
-                                    cluster_id);
-
+        }else{
+            MatchSnpClusterBatch(thread_index, snp_batch);
+            MatchClusterInThread(cluster_id, thread_index);
         }
 
         //if(method1 != method2){
@@ -893,29 +1134,228 @@ bool WholeGenome::ClusteringMatchInThread(int start, int end, int thread_index)
         //}
 
 	}
+    MatchSnpClusterBatch(thread_index, snp_batch);
 	return true;
 }
 
+bool WholeGenome::MatchClusterInThread(int cluster_id, int thread_index, SnpClusterBatch * snp_batch) {
+    vector<VariantIndicator> vi_list = variants_by_cluster[cluster_id];
+    // create variant_list from vi_list;
+
+    ClusterStat & cs = current_cluster_stat_by_thread[thread_index];
+    cs = ClusterStat(cluster_id, vi_list[0].chr_id, -1, -1, vi_list.size());
+    for(int i = 0; i < vi_list.size(); i++){
+        VariantIndicator vi = vi_list[i];
+        DiploidVariant & var = vi.refer ? ref_variant_by_chrid[vi.chr_id]->at(vi.var_id) : que_variant_by_chrid[vi.chr_id]->at(vi.var_id);
+        if(cs.start < 0 || var.pos < cs.start) cs.start = var.pos;
+        cs.end = max(cs.end, var.pos + (int)var.ref.length());
+    }
+    cs.begin = chrono::steady_clock::now();
+
+    int batch_cluster_num = snp_batch == NULL ? 0 : snp_batch->clusters.size();
+    MatchResultMark mark;
+    MarkMatchResults(thread_index, mark);
+    MatchClusterThresholds(vi_list, cluster_id, thread_index, snp_batch);
+    // a cluster uses one strategy on all thresholds and modes, so results of the thresholds and modes
+    // matched before the budget ran out are taken back and all of them are matched directly
+    if(cs.budget_exceeded){
+        RestoreMatchResults(thread_index, mark);
+        MatchClusterThresholds(vi_list, cluster_id, thread_index, snp_batch);
+    }
+
+    chrono::duration<double> cluster_time = chrono::steady_clock::now() - cs.begin;
+    cs.seconds = cluster_time.count();
+    if(cluster_report && snp_batch != NULL && snp_batch->clusters.size() > batch_cluster_num){
+        // reported when the batch is matched
+        for(int c = batch_cluster_num; c < snp_batch->clusters.size(); c++){
+            snp_batch->clusters[c].stat_index = snp_batch->cluster_stats.size();
+        }
+        snp_batch->cluster_stats.push_back(cs);
+    }else if(cluster_report){
+        cluster_stats_by_thread[thread_index]->push_back(cs);
+    }
+    if(cs.budget_exceeded){
+        budget_exceeded_clusters_by_thread[thread_index]->push_back(cs);
+    }
+    return true;
+}
+
+
+// matches the variants of a cluster passing each quality threshold
+void WholeGenome::MatchClusterThresholds(vector<VariantIndicator> & vi_list, int cluster_id, int thread_index, SnpClusterBatch * snp_batch){
+    bool fallback = current_cluster_stat_by_thread[thread_index].budget_exceeded;
+    for(int t = 0; t < threshold_num; t++){
+
+        double quality_threshold = threshold_list[t];
+
+        vector<DiploidVariant> variant_list;
+        int chr_id = -1;
+        for(int i = 0; i < vi_list.size(); i++){
+            VariantIndicator vi = vi_list[i];
+            chr_id = vi.chr_id;
+            int var_id = vi.var_id;
+            DiploidVariant var;
+            if(vi.refer){
+                var = ref_variant_by_chrid[chr_id]->at(var_id);
+            }else{
+                var = que_variant_by_chrid[chr_id]->at(var_id);
+            }
+            if(var.qual < quality_threshold) continue;
+            variant_list.push_back(var);
+        }
+        if(chr_id == -1 || chr_id >= chrom_num){
+            cout << "[VarMatch] Error in matching single cluster" << endl;
+            continue;
+        }
+
+        MatchVariantListInThread(thread_index, 
+                                t,
+                                chr_id,
+                                variant_list,
+                                cluster_id,
+                                snp_batch);
+        // all thresholds are matched again when the budget runs out here, see MatchClusterInThread
+        if(!fallback && current_cluster_stat_by_thread[thread_index].budget_exceeded) break;
+    }
+}
+
+// leave an empty record in place of the records of a huge cluster, see MatchDeferredCluster
+void WholeGenome::DeferCluster(int cluster_id, int thread_index){
+    DeferredCluster deferred_cluster;
+    deferred_cluster.cluster_id = cluster_id;
+    deferred_cluster.record_slot.assign(MATCH_MODE_NUM, -1);
+    for(int mi = 0; mi < mode_index_list.size(); mi++){
+        int mode_i = mode_index_list[mi];
+        vector<string> & match_records = *match_records_by_mode_by_thread[thread_index][mode_i];
+        deferred_cluster.record_slot[mode_i] = match_records.size();
+        match_records.push_back("");
+    }
+    deferred_clusters_by_thread[thread_index]->push_back(deferred_cluster);
+}
+
+// records of a deferred cluster are appended by matching, then moved into its empty record,
+// which keeps the cluster order of a run without --parallel_cluster_size
+void WholeGenome::MatchDeferredCluster(DeferredCluster & deferred_cluster, int thread_index){
+    MatchResultMark mark;
+    MarkMatchResults(thread_index, mark);
+    MatchClusterInThread(deferred_cluster.cluster_id, thread_index);
+    for(int mi = 0; mi < mode_index_list.size(); mi++){
+        int mode_i = mode_index_list[mi];
+        vector<string> & match_records = *match_records_by_mode_by_thread[thread_index][mode_i];
+        string & slot = match_records[deferred_cluster.record_slot[mode_i]];
+        for(int k = mark.record_num[mode_i]; k < match_records.size(); k++){
+            slot += match_records[k];
+        }
+        match_records.resize(mark.record_num[mode_i]);
+    }
+}
+
+void WholeGenome::MarkMatchResults(int thread_index, MatchResultMark & mark){
+    mark.record_num.assign(MATCH_MODE_NUM, 0);
+    mark.totals.clear();
+    for(int mi = 0; mi < mode_index_list.size(); mi++){
+        int mode_i = mode_index_list[mi];
+        mark.record_num[mode_i] = match_records_by_mode_by_thread[thread_index][mode_i]->size();
+        for(int t = 0; t < threshold_num; t++){
+            mark.totals.push_back(baseline_total_match_num[thread_index][t]->at(mode_i));
+            mark.totals.push_back(query_total_match_num[thread_index][t]->at(mode_i));
+            mark.totals.push_back(baseline_total_edit_distance[thread_index][t]->at(mode_i));
+            mark.totals.push_back(query_total_edit_distance[thread_index][t]->at(mode_i));
+        }
+    }
+}
+
+void WholeGenome::RestoreMatchResults(int thread_index, MatchResultMark & mark){
+    int k = 0;
+    for(int mi = 0; mi < mode_index_list.size(); mi++){
+        int mode_i = mode_index_list[mi];
+        match_records_by_mode_by_thread[thread_index][mode_i]->resize(mark.record_num[mode_i]);
+        for(int t = 0; t < threshold_num; t++){
+            baseline_total_match_num[thread_index][t]->at(mode_i) = mark.totals[k++];
+            query_total_match_num[thread_index][t]->at(mode_i) = mark.totals[k++];
+            baseline_total_edit_distance[thread_index][t]->at(mode_i) = mark.totals[k++];
+            query_total_edit_distance[thread_index][t]->at(mode_i) = mark.totals[k++];
+        }
+    }
+}
+
 
 // to reduce memory usage of paths, move all functions about SequencePath out into WholeGenome with a parameter SequencePath
-int WholeGenome::PathNeedDecision(SequencePath& sp, multimap<int, int> * choices_by_pos[], int pos){
+int WholeGenome::PathNeedDecision(SequencePath& sp, DecisionIndex & decision_index, int pos){
+    // baseline variants come before query variants in the chain
+    for(int var_index = decision_index.first_var_by_offset[pos]; var_index >= 0; var_index = decision_index.next_var[var_index]){
+        if(sp.choice_vector[var_index] <= MEANING_CHOICE_BOUND) return var_index;
+    }
+    return -1;
+}
+
+// variants starting at the same offset are chained baseline first, then query, each in variant_list order,
+// next_decision_offset lets extension skip the bases where nothing can be decided
+void WholeGenome::BuildDecisionIndex(DecisionIndex & decision_index,
+                                     vector<DiploidVariant> & variant_list,
+                                     vector<bool> & appliable_flag,
+                                     int offset,
+                                     int subsequence_length){
+    decision_index.first_var_by_offset.assign(subsequence_length + 1, -1);
+    decision_index.next_var.assign(variant_list.size(), -1);
+    decision_index.next_decision_offset.assign(subsequence_length + 2, subsequence_length + 1);
     for(int i = 0; i < 2; i++){
-        if(choices_by_pos[i]->find(pos) != choices_by_pos[i]->end()){
-            pair<multimap<int, int>::iterator, multimap<int, int>::iterator> var_range;
-            var_range = choices_by_pos[i]->equal_range(pos);
+        decision_index.variant_indexes[i].clear();
+    }
 
-            for(auto it = var_range.first; it != var_range.second; ++it){
-                int var_index = (*it).second;
-                if(sp.choice_vector[var_index] <= MEANING_CHOICE_BOUND) return var_index;
+    vector<int> last_var_by_offset(subsequence_length + 1, -1);
+    for(int flag = 0; flag < 2; flag++){
+        for(int index = 0; index < variant_list.size(); index++){
+            // remove decision point if not applicable
+            if(!appliable_flag[index]) continue;
+            if((int)variant_list[index].flag != flag) continue;
+            int pos = variant_list[index].pos - offset;
+            if(pos < 0 || pos > subsequence_length) continue;
+            if(last_var_by_offset[pos] < 0){
+                decision_index.first_var_by_offset[pos] = index;
+            }else{
+                decision_index.next_var[last_var_by_offset[pos]] = index;
             }
-            // you need to make choices now
-            // if(sp.choice_made[i].find(pos) == sp.choice_made[i].end()){
-            //     // no choice made at current pos
-            //     return true;
-            // }
+            last_var_by_offset[pos] = index;
+            decision_index.variant_indexes[flag].push_back(index);
         }
     }
-    return -1;
+
+    for(int pos = subsequence_length; pos >= 0; pos--){
+        if(decision_index.first_var_by_offset[pos] >= 0){
+            decision_index.next_decision_offset[pos] = pos;
+        }else{
+            decision_index.next_decision_offset[pos] = decision_index.next_decision_offset[pos+1];
+        }
+    }
+}
+
+// truth and query donors of haplotype y are equal, different hashes reject at once,
+// otherwise only the part after the confirmed equal prefix is compared
+bool WholeGenome::DonorPairEqual(SequencePath & sp, int y){
+    int donor_length = sp.donor_sequences[y].length();
+    if(donor_length != sp.donor_sequences[2+y].length()) return false;
+    if(sp.donor_hash[y] != sp.donor_hash[2+y]) return false;
+    for(int k = sp.current_equal_donor_pos[y]+1; k < donor_length; k++){
+        if(sp.donor_sequences[y][k] != sp.donor_sequences[2+y][k]) return false;
+    }
+    return true;
+}
+
+// the confirmed equal prefix of truth and query donors of haplotype y is never compared again,
+// drop it from both buffers so a path only stores the unresolved frontier
+void WholeGenome::DropEqualDonorPrefix(SequencePath & sp, int y){
+    int drop_length = sp.current_equal_donor_pos[y] + 1;
+    if(drop_length <= 0) return;
+    for(int i = y; i < 4; i += 2){
+        sp.donor_sequences[i].erase(0, drop_length);
+        sp.donor_hash[i] = 0;
+        for(int k = 0; k < sp.donor_sequences[i].length(); k++){
+            sp.donor_hash[i] = sp.donor_hash[i] * DONOR_HASH_BASE + (unsigned char)sp.donor_sequences[i][k];
+        }
+    }
+    sp.donor_skipped[y] += drop_length;
+    sp.current_equal_donor_pos[y] = -1;
 }
 
 // if match_mode == 1, i.e. variant match mode, only check one sequence
@@ -928,10 +1368,12 @@ int WholeGenome::CheckPathEqualProperty(SequencePath & sp, int match_mode)
         // same ref position, same donor length, same donor sequence, keep
         if(sp.donor_sequences[0].length() == sp.donor_sequences[2].length() &&
            sp.donor_sequences[1].length() == sp.donor_sequences[3].length()){
-            if(sp.donor_sequences[0] == sp.donor_sequences[2] && sp.donor_sequences[1] == sp.donor_sequences[3]){
+            if(DonorPairEqual(sp, 0) && DonorPairEqual(sp, 1)){
                 sp.same_donor_len = true;
                 sp.current_equal_donor_pos[0] = sp.donor_sequences[0].length()-1;
                 sp.current_equal_donor_pos[1] = sp.donor_sequences[1].length()-1;
+                DropEqualDonorPrefix(sp, 0);
+                DropEqualDonorPrefix(sp, 1);
                 return 0;
             }else{
                 //dout << "delete this path at pos: " << sp.current_genome_pos << " for not equal donor sequence";
@@ -951,14 +1393,17 @@ int WholeGenome::CheckPathEqualProperty(SequencePath & sp, int match_mode)
                 }
                 sp.current_equal_donor_pos[i] = min_donor_identical_len[i]-1;
             }
+            DropEqualDonorPrefix(sp, 0);
+            DropEqualDonorPrefix(sp, 1);
             return 0;
         }
     }else{
         if(sp.donor_sequences[0].length() == sp.donor_sequences[2].length()){
-            if(sp.donor_sequences[0] == sp.donor_sequences[2]){
+            if(DonorPairEqual(sp, 0)){
                 sp.same_donor_len = true;
                 sp.current_equal_donor_pos[0] = sp.donor_sequences[0].length()-1;
                 //sp.current_equal_donor_pos[1] = sp.donor_sequences[1].length()-1;
+                DropEqualDonorPrefix(sp, 0);
                 return 0;
             }else{
                 //dout << "delete this path at pos: " << sp.current_genome_pos << " for not equal donor sequence";
@@ -980,6 +1425,7 @@ int WholeGenome::CheckPathEqualProperty(SequencePath & sp, int match_mode)
                 }
                 sp.current_equal_donor_pos[i] = min_donor_identical_len[i]-1;
             }
+            DropEqualDonorPrefix(sp, 0);
             return 0;
         }
     }
@@ -988,7 +1434,7 @@ int WholeGenome::CheckPathEqualProperty(SequencePath & sp, int match_mode)
 // one step is not one nt, but to the next sync point
 // i.e. one step, one sync point
 int WholeGenome::PathExtendOneStep(SequencePath& sp,
-                                   multimap<int, int> * choices_by_pos[],
+                                   DecisionIndex & decision_index,
                                    const string & reference_sequence,
                                    vector<int> & sync_points,
                                    int match_mode,
@@ -1003,33 +1449,30 @@ int WholeGenome::PathExtendOneStep(SequencePath& sp,
     int start_pos = sp.current_genome_pos + 1;
     int end_pos = sync_points[sp.reached_sync_num]; // the next sync point, end pos included
 
-    for(int next_genome_pos = start_pos; next_genome_pos <= end_pos; next_genome_pos++){
-
-        // before make decision, we need to check if the equal property still holds
-        int variant_need_decision_ = PathNeedDecision(sp, choices_by_pos, next_genome_pos);
-        if(variant_need_decision_ >= 0){
-
-            // check equal property
-            int statu = CheckPathEqualProperty(sp, match_mode);
-            if(statu == -1) return -1;
-            variant_need_decision = variant_need_decision_;
-            return 1; // need decision on next position
-        }
-
-        // else extend one nt
-        for(int i = 0; i < 4; i++){
-
-            if(match_mode == 1){
-                if(i%2 != 0) continue;
-            }
-
-            if(sp.string_sequences[i][next_genome_pos] == "."){
-                sp.donor_sequences[i] += reference_sequence[next_genome_pos];
-            }else{
-                sp.donor_sequences[i] += sp.string_sequences[i][next_genome_pos];
+    int next_genome_pos = start_pos;
+    while(next_genome_pos <= end_pos){
+        // jump to the next position where a variant starts
+        int decision_pos = decision_index.next_decision_offset[next_genome_pos];
+        if(decision_pos == next_genome_pos){
+            // before make decision, we need to check if the equal property still holds
+            int variant_need_decision_ = PathNeedDecision(sp, decision_index, next_genome_pos);
+            if(variant_need_decision_ >= 0){
+
+                // check equal property
+                int statu = CheckPathEqualProperty(sp, match_mode);
+                if(statu == -1) return -1;
+                variant_need_decision = variant_need_decision_;
+                return 1; // need decision on next position
             }
+            // all variants here are decided
+            decision_pos = decision_index.next_decision_offset[next_genome_pos+1];
         }
-        sp.current_genome_pos = next_genome_pos;
+
+        // else extend until the next decision point
+        int extend_end = min(decision_pos - 1, end_pos);
+        ExtendDonorSequences(sp, reference_sequence, next_genome_pos, extend_end, match_mode);
+        sp.current_genome_pos = extend_end;
+        next_genome_pos = extend_end + 1;
     }
 
     // reaches the end of end_pos
@@ -1037,8 +1480,7 @@ int WholeGenome::PathExtendOneStep(SequencePath& sp,
 
     if(sp.reached_sync_num >= sync_points.size()){
         // last sync point is the end of ref genome sequence
-        if(sp.donor_sequences[0] == sp.donor_sequences[2] &&
-           sp.donor_sequences[1] == sp.donor_sequences[3]){
+        if(DonorPairEqual(sp, 0) && DonorPairEqual(sp, 1)){
             return 2;
        }else{
             //dout << "delete this path at pos: " << sp.current_genome_pos << " for reach end but not equal";
@@ -1051,6 +1493,55 @@ int WholeGenome::PathExtendOneStep(SequencePath& sp,
 
 }
 
+// append reference positions [start_pos, end_pos] to donors, unmodified reference runs are copied at once
+// while truth and query donors of a haplotype are identical, the reference bases they share are only counted
+// in donor_skipped, removing the same bases at the same position from both keeps equality and length differences
+void WholeGenome::ExtendDonorSequences(SequencePath & sp,
+                                       const string & reference_sequence,
+                                       int start_pos,
+                                       int end_pos,
+                                       int match_mode){
+    for(int y = 0; y < 2; y++){
+        if(match_mode == 1 && y == 1) continue;
+        int k = start_pos;
+        if(sp.donor_sequences[y].length() == sp.donor_sequences[2+y].length() &&
+           sp.current_equal_donor_pos[y] == (int)sp.donor_sequences[y].length() - 1){
+            while(k <= end_pos && sp.string_sequences[y][k] == "." && sp.string_sequences[2+y][k] == ".") k++;
+            sp.donor_skipped[y] += k - start_pos;
+        }
+        for(int i = y; i < 4; i += 2){
+            int donor_length = sp.donor_sequences[i].length();
+            int run_start = k;
+            for(int j = k; j <= end_pos; j++){
+                if(sp.string_sequences[i][j] == ".") continue;
+                sp.donor_sequences[i].append(reference_sequence, run_start, j - run_start);
+                sp.donor_sequences[i] += sp.string_sequences[i][j];
+                run_start = j + 1;
+            }
+            sp.donor_sequences[i].append(reference_sequence, run_start, end_pos + 1 - run_start);
+            for(int j = donor_length; j < sp.donor_sequences[i].length(); j++){
+                sp.donor_hash[i] = sp.donor_hash[i] * DONOR_HASH_BASE + (unsigned char)sp.donor_sequences[i][j];
+            }
+        }
+    }
+}
+
+// full donor sequences including skipped reference bases, for match records
+void WholeGenome::RebuildDonorSequences(SequencePath & sp, const string & reference_sequence){
+    for(int i = 0; i < 4; i++){
+        sp.donor_sequences[i] = "";
+        for(int k = 0; k <= sp.current_genome_pos; k++){
+            if(sp.string_sequences[i][k] == "."){
+                sp.donor_sequences[i] += reference_sequence[k];
+            }else{
+                sp.donor_sequences[i] += sp.string_sequences[i][k];
+            }
+        }
+    }
+    sp.donor_skipped[0] = 0;
+    sp.donor_skipped[1] = 0;
+}
+
 int WholeGenome::CalculateScore(DiploidVariant & dv,
                                 int choice,
                                 int score_unit,
@@ -1091,6 +1582,7 @@ int WholeGenome::CalculateScore(DiploidVariant & dv,
             return 0;
         }
     }
+    return score;
 }
 
 
@@ -1123,286 +1615,152 @@ int WholeGenome::CalculateEditDistance(DiploidVariant & dv,
 }
 
 
-// function no longer used, move to VariantMakeDecisionNoGenotype
-// no genotype means you can maintain only one strand
-// for simplicity, also work on original SequencePath data structure
-// when making decision, only decide one path
-// when extending, only extend one path
-// when comparing, only compare one path
-bool WholeGenome::PathMakeDecisionNoGenotype(SequencePath& sp,
-                                 vector<DiploidVariant> & variant_list,
-                                 multimap<int, int> * choices_by_pos[],
-                                 list<SequencePath> & sequence_path_list,
-                                 const string & reference_sequence,
-                                 int score_unit,
-                                 int match_mode,
-                                 int score_scheme)
+bool WholeGenome::AppendChangedSp(SequencePath& sp,
+                         vector<DiploidVariant> & variant_list,
+                         list<SequencePath> & sequence_path_list,
+                         const string & reference_sequence,
+                         int score_unit,
+                         int match_mode,
+                         int score_scheme,
+                         int variant_index,
+                         int c)
 {
     int pos = sp.current_genome_pos+1;
-    vector<pair<int, int>> candidate_choices[2];
-    for(int i = 0; i < 2; i++){
-        // because if it's (-1,-1), it will do nothing, so it's ok to have this one...
-        candidate_choices[i].push_back(pair<int, int>(-1, -1));
-        // to maintain existance
-        // in this position, make choice of not use any variants, no matter if there is variant
-
-        pair<multimap<int, int>::iterator, multimap<int, int>::iterator> var_range;
-        var_range = choices_by_pos[i]->equal_range(pos);
-
-        for(auto it = var_range.first; it != var_range.second; ++it){
-            int var_index = (*it).second;
-            DiploidVariant var = variant_list[var_index];
-            // check if current var influence
-            string ref = var.ref; //even we do not know the offset, we know ref start from pos of reference_sequence
-            string alts[2];
-            alts[0] = var.alts[0];
-            alts[1] = alts[0];
-            if(var.multi_alts){ //here do not have to change anything
-                alts[1] = var.alts[1];
-            }
-
-            // not just purely consider if a vqriant can be applied, but if a choice
-            bool choice_applicable = true;
-            for(int k = 0; k < ref.length(); k++){
-            // for each ref char
-                int y = 0;
-                // for each strain
-                if(sp.string_sequences[i*2+y][k+pos] != "."){
-                    // decision in this area has already been made
-                    if(k >= alts[y].length()){
-                        choice_applicable = false;
-                        break;
-                    }else{
-                        if(ref[k] != alts[y][k]){
-                            choice_applicable = false;
-                            break;
-                        }
-                    }
-                }
-            }
-
-            if(choice_applicable){
-                candidate_choices[i].push_back(pair<int, int>(var_index, 0));
-            }
 
-            if(var.multi_alts){ // here do not have to change anything
-
-                //if heterozygous, then there is another choice, check if it is applicable
-                string temp = alts[0];
-                alts[0] = alts[1];
-                alts[1] = temp;
+    SequencePath path = sp;
 
-                choice_applicable = true;
-                for(int k = 0; k < ref.length(); k++){
-                // for each ref char
-                    //for(int y = 0; y < 2; y++)
-                    int y = 0;
-                    // for each strain
-                    if(sp.string_sequences[i*2+y][k+pos] != "."){
-                        // decision in this area has already been made
-                        if(k >= alts[y].length()){
-                            // should be a deletion
-                            choice_applicable = false;
-                            break;
-                        }else{
-                            // should be equal at current position
-                            // can be an insertion, as long as current position is the same
-                            if(ref[k] != alts[y][k]){
-                                choice_applicable = false;
-                                break;
-                            }
-                        }
-                    }
-                }
+    int x = 0;
+    if(variant_list[variant_index].flag) x = 1;
+    path.undecided_mil[x] -= variant_list[variant_index].mil;
+    path.undecided_mdl[x] -= variant_list[variant_index].mdl;
 
-                if(choice_applicable){
-                    candidate_choices[i].push_back(pair<int, int>(var_index, 1));
-                }
-            }
-        }
+    if(c == NOT_USE){
+        path.choice_vector.set(variant_index, c);
+        if(!PathLengthBalanced(path, match_mode)) return false;
+        sequence_path_list.push_back(path);
+        return true;
     }
 
-    //dout << candidate_choices[0].size() << "," << candidate_choices[1].size() << endl;
-
-    for(int i = 0; i < candidate_choices[0].size(); i++){
-        for(int j = 0; j < candidate_choices[1].size(); j++){
-            // iterate all choices
-            SequencePath path = sp;
-            pair<int, int> var_choice[2];
-            var_choice[0] = candidate_choices[0][i];
-            var_choice[1] = candidate_choices[1][j];
-            for(int x = 0; x < 2; x++){
-                // iterate truth and predict
-                int var_index = var_choice[x].first;
-                if(var_index != -1){
-                    DiploidVariant var = variant_list[var_index];
-                    // if(var.flag != x){
-                    //     dout << "Error" << endl;
-                    // }
-                    string ref = var.ref;
-                    string alts[2];
-                    int c = var_choice[x].second;
-                    alts[0] = var.alts[c];
-                    path.score += CalculateScore(var,
-                                                 c,
-                                                 score_unit,
-                                                 match_mode,
-                                                 score_scheme);
-
-                    ToUpper(ref);
-                    ToUpper(alts[0]);
-                    int y = 0;
-
-                    int k = 0;
-                    for(; k < ref.length()-1; k++){
-                        if(k < alts[y].length()){
-                            if(ref[k] != alts[y][k]){
-                                path.string_sequences[x*2+y][pos+k] = alts[y].substr(k,1);
-                            }
-                            // else change nothing
-                        }else{
-                            path.string_sequences[x*2+y][pos+k] = "";
-                        }
-                    }
-                    // hence k == ref.length()-1, the last position
-                    if(k < alts[y].length()){
-                        string alt_part = alts[y].substr(k, alts[y].length()-k);
-                        if(alt_part.length() > 1){
-                            if(alt_part[0] == ref[k]){
-                                if(path.string_sequences[x*2+y][pos+k] == "."){
-                                    path.string_sequences[x*2+y][pos+k] = alt_part;
-                                }else{
-                                    path.string_sequences[x*2+y][pos+k] += alt_part.substr(1, alt_part.size() - 1);
-                                }
-                            }else{
-                                path.string_sequences[x*2+y][pos+k] = alt_part;
-                            }
-                        }else{
-                            if(ref[k] != alts[y][k]){
-                                path.string_sequences[x*2+y][pos+k] = alt_part;
-                            }
-                        }
-                    }else{
-                        path.string_sequences[x*2+y][pos+k] = "";
-                    }
-
-                }
-                path.choice_made[x][pos] = var_choice[x];
-            }
-            sequence_path_list.push_back(path);
-        }
-    }
-
-    //expected number of inserted paths are 2,3,4,6,x...
-    return true;
-}
-
-bool WholeGenome::AppendChangedSp(SequencePath& sp,
-                         vector<DiploidVariant> & variant_list,
-                         list<SequencePath> & sequence_path_list,
-                         const string & reference_sequence,
-                         int score_unit,
-                         int match_mode,
-                         int score_scheme,
-                         int variant_index,
-                         int c)
-{
-    int pos = sp.current_genome_pos+1;
-
-    SequencePath path = sp;
-
-    if(c == NOT_USE){
-        path.choice_vector[variant_index] = c;
-        sequence_path_list.push_back(path);
-        return true;
-    }
-
-    pair<int, int> var_choice[2];
-    int x = 0;
-    int var_index = variant_index;
-    DiploidVariant var = variant_list[var_index];
-    if(var.flag) x = 1;
-    string ref = var.ref;
-    string alts[2];
+    DiploidVariant & var = variant_list[variant_index];
+    const string & ref = var.ref;
+    // alt index applied to each haplotype, -1 keeps reference
+    int alt_indexes[2] = {-1, -1};
 
     if(c == -1){
-        alts[0] = ref;
-        alts[1] = var.alts[0];
+        alt_indexes[1] = 0;
     }else if(c == -2){
-        alts[0] = ref;
-        alts[1] = var.alts[1];
+        alt_indexes[1] = 1;
     }else if(c >= 0){
         // c == 0 or 1
-        alts[0] = var.alts[c];
-        alts[1] = alts[0];
+        alt_indexes[0] = c;
+        alt_indexes[1] = c;
 
         if(var.multi_alts && !var.zero_one_var){
             // choose 1 or 0
-            alts[1] = var.alts[1- c];
+            alt_indexes[1] = 1 - c;
         }else{
             // c is 0, choose 0 or -1
-            if(var.heterozygous) alts[1] = ref;
+            if(var.heterozygous) alt_indexes[1] = -1;
         }
     }else{
         dout << "Unrecognized choice" << endl;
     }
+    if(alt_indexes[0] != alt_indexes[1]) path.phasing_symmetric = false;
     path.score += CalculateScore(var,
                                  c,
                                  score_unit,
                                  match_mode,
                                  score_scheme);
-    ToUpper(ref);
-    ToUpper(alts[0]);
-    ToUpper(alts[1]);
     for(int y = 0; y < 2; y++){
         // iterate two alts
-        string alt = alts[y];
-        if(alt == ref) continue;
-        vector<string> alt_vector;
-        GenerateAltVector(ref, alt, alt_vector);
+        if(alt_indexes[y] < 0) continue;
+        if(var.alts[alt_indexes[y]] == ref) continue;
+        const vector<string> & alt_vector = var.alt_vectors[alt_indexes[y]];
 
         int k = 0;
         for(; k < ref.length()-1; k++){
 
             if(alt_vector[k].size() != 1 || ref[k] != alt_vector[k][0]){
-                path.string_sequences[x*2+y][pos+k] = alt_vector[k];
+                path.SetSequence(x*2+y, pos+k, alt_vector[k]);
             }
             // else changes nothing
 
         }
         // hence k == ref.length()-1, the last position
         assert(k == ref.length()-1);
-        string alt_part = alt_vector[k];
+        const string & alt_part = alt_vector[k];
         if(alt_part.length() > 0){
             if(alt_part.length() > 1){
                 if(alt_part[0] == ref[k]){
                     if(path.string_sequences[x*2+y][pos+k] == "."){
-                        path.string_sequences[x*2+y][pos+k] = alt_part;
+                        path.SetSequence(x*2+y, pos+k, alt_part);
                     }else{
-                        path.string_sequences[x*2+y][pos+k] += alt_part.substr(1, alt_part.size() - 1);
+                        path.AppendSequence(x*2+y, pos+k, alt_part.substr(1, alt_part.size() - 1));
                     }
                 }else{
-                    path.string_sequences[x*2+y][pos+k] = alt_part;
+                    path.SetSequence(x*2+y, pos+k, alt_part);
                 }
             }else{
                 if(ref[k] != alt_vector[k][0]){
-                    path.string_sequences[x*2+y][pos+k] = alt_part;
+                    path.SetSequence(x*2+y, pos+k, alt_part);
                 }
             }
         }else{
-            path.string_sequences[x*2+y][pos+k] = "";
+            path.SetSequence(x*2+y, pos+k, "");
         }
     }
 
     // choice made
-    path.choice_vector[variant_index] = c;
+    path.choice_vector.set(variant_index, c);
     //dout << "after decision at variant " << variant_index << endl;
     //PrintPath(path);
+    if(!PathLengthBalanced(path, match_mode)) return false;
     sequence_path_list.push_back(path);
     return true;
 }
 
 
+// swapping haplotypes of both truth and query keeps every later choice and its score
+// as long as no multi-alt 0/1 variant is scored by edit distance, as choice 1 and -2 score differently
+bool WholeGenome::MirrorChoicesEquivalent(vector<DiploidVariant> & variant_list,
+                                          int score_unit,
+                                          int match_mode){
+    if(match_mode != 0) return false;
+    if(score_unit == 0) return true;
+    for(int i = 0; i < variant_list.size(); i++){
+        if(variant_list[i].multi_alts && variant_list[i].zero_one_var) return false;
+    }
+    return true;
+}
+
+// length changes of undecided variants in decision_index, these are the only variants a path can still apply
+void WholeGenome::InitializeLengthBalance(SequencePath & sp,
+                                          vector<DiploidVariant> & variant_list,
+                                          DecisionIndex & decision_index){
+    for(int i = 0; i < 2; i++){
+        sp.undecided_mil[i] = 0;
+        sp.undecided_mdl[i] = 0;
+        for(int k = 0; k < decision_index.variant_indexes[i].size(); k++){
+            sp.undecided_mil[i] += variant_list[decision_index.variant_indexes[i][k]].mil;
+            sp.undecided_mdl[i] += variant_list[decision_index.variant_indexes[i][k]].mdl;
+        }
+    }
+}
+
+// donor sequences of truth and query can only be equal if they have the same length,
+// a path is discarded if undecided variants can not make up the length difference of any haplotype
+bool WholeGenome::PathLengthBalanced(SequencePath & sp, int match_mode){
+    int haplotype_num = 2;
+    if(match_mode == 1) haplotype_num = 1;
+    for(int y = 0; y < haplotype_num; y++){
+        int length_diff = sp.length_change[y] - sp.length_change[2+y];
+        // truth can still change by [-mdl, mil], query by [-mdl, mil]
+        if(length_diff > sp.undecided_mdl[0] + sp.undecided_mil[1]) return false;
+        if(-length_diff > sp.undecided_mil[0] + sp.undecided_mdl[1]) return false;
+    }
+    return true;
+}
+
 // Question: when you make decision, do you also need to align?
 // Answer: No, as it makes no difference, so currently you can skip alignment
 bool WholeGenome::VariantMakeDecision(SequencePath& sp,
@@ -1418,7 +1776,7 @@ bool WholeGenome::VariantMakeDecision(SequencePath& sp,
     int pos = sp.current_genome_pos+1;
 
     int var_index = variant_index;
-    DiploidVariant var = variant_list[var_index];
+    DiploidVariant & var = variant_list[var_index];
 
     // also this variant may not be used
     AppendChangedSp(sp,
@@ -1485,7 +1843,8 @@ bool WholeGenome::VariantMakeDecision(SequencePath& sp,
                         0);
     }
 
-    if(var.heterozygous){
+    // while both haplotype pairs are identical, the swapped choice only builds the mirror of choice 0
+    if(var.heterozygous && !sp.phasing_symmetric){
 
         //if heterozygous, then there is another choice, check if it is applicable
 
@@ -1620,7 +1979,7 @@ bool WholeGenome::VariantMakeDecision(SequencePath& sp,
             if(!choice_applicable) break;
         }
 
-        if(choice_applicable){
+        if(choice_applicable && !sp.phasing_symmetric){
             //candidate_choices[i].push_back(pair<int, int>(var_index, -2));
             AppendChangedSp(sp,
                 variant_list,
@@ -1633,7 +1992,7 @@ bool WholeGenome::VariantMakeDecision(SequencePath& sp,
                 -2);
         }
     }
-        
+    return true;
 }
 
 // no genotype means you only need to maintain one strand
@@ -1766,7 +2125,8 @@ bool WholeGenome::VariantMakeDecisionNoGenotype(SequencePath& sp,
                     var_index,
                     1);
         }
-    }   
+    }
+    return true;
 }
 
 
@@ -1782,24 +2142,23 @@ bool WholeGenome::AppendChangedSpNoGenotype(SequencePath& sp,
 {
     int pos = sp.current_genome_pos+1;
     SequencePath path = sp;
+
+    int x = 0;
+    if(variant_list[variant_index].flag) x = 1;
+    path.undecided_mil[x] -= variant_list[variant_index].mil;
+    path.undecided_mdl[x] -= variant_list[variant_index].mdl;
+
     if(c == NOT_USE){
-        path.choice_vector[variant_index] = c;
+        path.choice_vector.set(variant_index, c);
+        if(!PathLengthBalanced(path, match_mode)) return false;
         sequence_path_list.push_back(path);
         return true;
     }
 
-    pair<int, int> var_choice[2];
-    int x = 0;
-    int var_index = variant_index;
-    DiploidVariant var = variant_list[var_index];
-    if(var.flag) x = 1;
-    string ref = var.ref;
-    string alts[2];
+    DiploidVariant & var = variant_list[variant_index];
+    const string & ref = var.ref;
 
-    if(c == 0 || c == 1){
-        // c == 0 or 1
-        alts[0] = var.alts[c];
-    }else{
+    if(c != 0 && c != 1){
         dout << "Unrecognized choice" << endl;
     }
     path.score += CalculateScore(var,
@@ -1807,377 +2166,671 @@ bool WholeGenome::AppendChangedSpNoGenotype(SequencePath& sp,
                                  score_unit,
                                  match_mode,
                                  score_scheme);
-    ToUpper(ref);
-    ToUpper(alts[0]);
     int y = 0;
-
-    string alt = alts[y];
-    vector<string> alt_vector;
-    GenerateAltVector(ref, alt, alt_vector);
+    const vector<string> & alt_vector = var.alt_vectors[c];
     int k = 0;
     for(; k < ref.length()-1; k++){
         if(alt_vector[k].size() != 1 || ref[k] != alt_vector[k][0]){
-            path.string_sequences[x*2+y][pos+k] = alt_vector[k];
+            path.SetSequence(x*2+y, pos+k, alt_vector[k]);
         }
         // else changes nothing
     }
     // hence k == ref.length()-1, the last position
     assert(k == ref.length()-1);
-    string alt_part = alt_vector[k];
+    const string & alt_part = alt_vector[k];
     if(alt_part.length() > 0){
         if(alt_part.length() > 1){
             if(alt_part[0] == ref[k]){
                 if(path.string_sequences[x*2+y][pos+k] == "."){
-                    path.string_sequences[x*2+y][pos+k] = alt_part;
+                    path.SetSequence(x*2+y, pos+k, alt_part);
                 }else{
-                    path.string_sequences[x*2+y][pos+k] += alt_part.substr(1, alt_part.size() - 1);
+                    path.AppendSequence(x*2+y, pos+k, alt_part.substr(1, alt_part.size() - 1));
                 }
             }else{
-                path.string_sequences[x*2+y][pos+k] = alt_part;
+                path.SetSequence(x*2+y, pos+k, alt_part);
             }
         }else{
             if(ref[k] != alt_vector[k][0]){
-                path.string_sequences[x*2+y][pos+k] = alt_part;
+                path.SetSequence(x*2+y, pos+k, alt_part);
             }
         }
     }else{
-        path.string_sequences[x*2+y][pos+k] = "";
+        path.SetSequence(x*2+y, pos+k, "");
     }
     // choice made
-    path.choice_vector[variant_index] = c;
+    path.choice_vector.set(variant_index, c);
     //dout << "after decision at variant " << variant_index << endl;
     //PrintPath(path);
+    if(!PathLengthBalanced(path, match_mode)) return false;
     sequence_path_list.push_back(path);
     return true;
 }
 
-// this function is no longer used, because you can not make decison for one position at once,
-// there might be multiple variants in one position,
-// so a better way to do this is to make decision for one variant at a time
-// previously I just want to save some time, but ignore the multiple variant condition
-bool WholeGenome::PathMakeDecision(SequencePath& sp,
-                                 vector<DiploidVariant> & variant_list,
-                                 multimap<int, int> * choices_by_pos[],
-                                 list<SequencePath> & sequence_path_list,
-                                 const string & reference_sequence,
-                                 int score_unit,
-                                 int match_mode,
-                                 int score_scheme)
-{
-    int pos = sp.current_genome_pos+1;
-
-    vector<pair<int, int>> candidate_choices[2];
-    for(int i = 0; i < 2; i++){
+void WholeGenome::PrintPath(SequencePath & sp){
+    cout << "- Sequence Path:" << endl;
+    cout << "@ String Sequences:" << endl;
+    for(int i = 0; i < 4; i++){
+        for(int j = 0; j < sp.string_sequences[i].size(); j++){
+            cout << sp.string_sequences[i][j] << " ";
+        }
+        cout << endl;
+    }
+    cout << "@ Donor Sequences:" << endl;
+    for(int i = 0; i < 4; i++){
+        cout << sp.donor_sequences[i] << endl;
+    }
+    cout << "@ Removable: " << sp.removable << endl;
 
-        // because if it's (-1,-1), it will do nothing, so it's ok to have this one...
-        candidate_choices[i].push_back(pair<int, int>(-1, -1));
-        // in this position, make choice of not use any variants, no matter if there is variant
+    for(int i = 0; i < sp.choice_vector.size(); i++){
+        cout << sp.choice_vector[i] << ",";
+    }
+    cout << endl;
+}
 
-        pair<multimap<int, int>::iterator, multimap<int, int>::iterator> var_range;
-        var_range = choices_by_pos[i]->equal_range(pos);
+// rough size of a path in bytes, used to bound memory of path lists
+long long WholeGenome::PathMemory(SequencePath & sp){
+    long long memory = sizeof(SequencePath);
+    memory += 4LL * sp.reference_length * sizeof(string);
+    memory += sp.choice_vector.HeapMemory();
+    for(int i = 0; i < 4; i++){
+        memory += sp.donor_sequences[i].capacity();
+    }
+    return memory;
+}
 
-        for(auto it = var_range.first; it != var_range.second; ++it){
-            int var_index = (*it).second;
-            DiploidVariant var = variant_list[var_index];
-            //PrintVariant(var);
+bool WholeGenome::ClusterBudgetExceeded(int thread_index, int path_list_size, long long path_memory){
+    if(cluster_budget.max_path_num > 0 && path_list_size > cluster_budget.max_path_num) return true;
+    if(cluster_budget.max_path_memory > 0 &&
+       path_list_size * path_memory > cluster_budget.max_path_memory * 1024LL * 1024LL) return true;
+    if(cluster_budget.max_seconds > 0){
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - current_cluster_stat_by_thread[thread_index].begin;
+        if(elapsed.count() > cluster_budget.max_seconds) return true;
+    }
+    return false;
+}
 
-            // check if current var influence
-            string ref = var.ref; //even we do not know the offset, we know ref start from pos of reference_sequence
-            string alts[2];
-            alts[0] = var.alts[0];
-            alts[1] = alts[0];
-            if(var.multi_alts && !var.zero_one_var){
-                alts[1] = var.alts[1];
-            }else if(var.heterozygous){
-                alts[1] = ref;
-            }
-
-            // not just purely consider if a vqriant can be applied, but if a choice
-            int skiped_y = -1;
-            if(alts[1] == ref) skiped_y = 1;
-
-            bool choice_applicable = true;
-            for(int k = 0; k < ref.length(); k++){
-            // for each ref char
-                for(int y = 0; y < 2; y++){
-                    // for each strain
-                    if(y == skiped_y) continue;
-                    if(sp.string_sequences[i*2+y][k+pos] != "."){
-                        // decision in this area has already been made
-                        if(k >= alts[y].length()){
-                            choice_applicable = false;
-                            break;
-                        }else{
-                            if(ref[k] != alts[y][k]){
-                                choice_applicable = false;
-                                break;
-                            }
-                        }
-                    }
-                }
-                if(!choice_applicable) break;
-            }
-
-            if(choice_applicable){
-                candidate_choices[i].push_back(pair<int, int>(var_index, 0));
-            }
-
-            if(var.heterozygous){
-
-                //if heterozygous, then there is another choice, check if it is applicable
-
-                string temp = alts[0];
-                alts[0] = alts[1];
-                alts[1] = temp;
-
-                skiped_y = -1;
-                if(alts[0] == ref) skiped_y = 0;
-
-                choice_applicable = true;
-                for(int k = 0; k < ref.length(); k++){
-                // for each ref char
-                    for(int y = 0; y < 2; y++){
-                        // for each strain
-                        if(skiped_y == y) continue;
-                        if(sp.string_sequences[i*2+y][k+pos] != "."){
-                            // decision in this area has already been made
-                            if(k >= alts[y].length()){
-                                // should be a deletion
-                                choice_applicable = false;
-                                break;
-                            }else{
-                                // should be equal at current position
-                                // can be an insertion, as long as current position is the same
-                                if(ref[k] != alts[y][k]){
-                                    choice_applicable = false;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    if(!choice_applicable) break;
-                }
+// fallback for clusters exceeding matching budget
+// only variants with identical representation are matched, one to one
+void WholeGenome::DirectMatchVariantList(int thread_index,
+                                         int threshold_index,
+                                         int chr_id,
+                                         vector<DiploidVariant> & variant_list,
+                                         int match_mode,
+                                         int mode_index){
+    vector<bool> matched(variant_list.size(), false);
+    for(int i = 0; i < variant_list.size(); i++){
+        DiploidVariant & ref_var = variant_list[i];
+        if(ref_var.flag) continue;
+        for(int j = 0; j < variant_list.size(); j++){
+            DiploidVariant & que_var = variant_list[j];
+            if(!que_var.flag || matched[j] || que_var.pos != ref_var.pos) continue;
+            bool is_match = false;
+            if(match_mode == 0){
+                is_match = ref_var == que_var;
+            }else{
+                is_match = ref_var.CompareNoGenotype(que_var);
+            }
+            if(!is_match) continue;
+            matched[j] = true;
+
+            if(threshold_index == 0){
+                string match_record = chrname_by_chrid[chr_id] + "\t" + to_string(ref_var.pos+1) + "\t" + ref_var.ref + "\t" + ref_var.alts[0];
+                if(ref_var.multi_alts) match_record += "/" + ref_var.alts[1];
+                match_record += "\t.\t.\t.\t.\t.\n";
+                match_records_by_mode_by_thread[thread_index][mode_index]->push_back(match_record);
+            }
+            int edit_distance = CalculateEditDistance(ref_var, 0, 0);
+            baseline_total_match_num[thread_index][threshold_index]->at(mode_index)++;
+            query_total_match_num[thread_index][threshold_index]->at(mode_index)++;
+            baseline_total_edit_distance[thread_index][threshold_index]->at(mode_index) += edit_distance;
+            query_total_edit_distance[thread_index][threshold_index]->at(mode_index) += edit_distance;
+            break;
+        }
+    }
+}
 
-                if(choice_applicable){
-                    if(var.multi_alts && !var.zero_one_var){
-                        candidate_choices[i].push_back(pair<int, int>(var_index, 1));
-                    }else{
-                        candidate_choices[i].push_back(pair<int, int>(var_index, -1));
-                    }
-                }
+// extend every path in current_path_list to the next sync point, paths needing a decision are branched
+// and extended in the same list, returns true if the cluster budget is exceeded
+bool WholeGenome::ExtendPathsToSyncPoint(int thread_index,
+                                         int worker_num,
+                                         list<SequencePath> & current_path_list,
+                                         list<SequencePath> & next_path_list,
+                                         SequencePath & best_path,
+                                         vector<DiploidVariant> & variant_list,
+                                         string & subsequence,
+                                         DecisionIndex & decision_index,
+                                         vector<int> & sync_points,
+                                         int score_unit,
+                                         int match_mode,
+                                         int score_scheme,
+                                         long long & path_num,
+                                         int & max_path_list_size,
+                                         long long & path_memory){
+    while(current_path_list.size() != 0){
+        // workers hold similar shares of the frontier
+        int path_list_size = (current_path_list.size() + next_path_list.size()) * worker_num;
+        max_path_list_size = max(max_path_list_size, (int)current_path_list.size());
+        path_num ++;
+        if(ClusterBudgetExceeded(thread_index, path_list_size, path_memory)){
+            return true;
+        }
+        SequencePath path = current_path_list.front();
+        current_path_list.pop_front();
+        //dout << path.current_genome_pos << ":" << current_path_list.size() << endl;
+        //PrintPath(path);
+        int variant_need_decision = -1;
+        int is_extend = PathExtendOneStep(path, decision_index, subsequence, sync_points, match_mode, variant_need_decision);
+        //cout << variant_need_decision << endl;
+        //PrintPath(path);
+        if(is_extend == -1){
+            // discard path
+            continue;
+        }
+        else if(is_extend == 0){
+            next_path_list.push_back(path);
+            // here the path is supposed to reach the next sync point
+            // so it goes into next path list, and decrease the number of current path list
+        }else if(is_extend == 1){
+            path.decision_num++;
+            if(match_mode == 0){
+                VariantMakeDecision(path,
+                                     variant_list,
+                                     current_path_list,
+                                     subsequence,
+                                     score_unit,
+                                     match_mode,
+                                     score_scheme,
+                                     variant_need_decision);
+            }else{
+                VariantMakeDecisionNoGenotype(path,
+                                             variant_list,
+                                             current_path_list,
+                                             subsequence,
+                                             score_unit,
+                                             match_mode,
+                                             score_scheme,
+                                             variant_need_decision);
             }
+        }else if(is_extend == 2){
+            if(path.score > best_path.score){
+                best_path = path; // only when you reach the very end can you be considered as best path
+                //PrintPath(best_path);
+            }
+        }
+        path_memory = PathMemory(path);
+    }
+    return false;
+}
 
-            if(var.multi_alts && var.zero_one_var){
-                // here contains another two combinations  alt1/ref and ref/alt1
-                alts[0] = var.alts[1];
-                alts[1] = ref;
-
-                choice_applicable = true;
-                int y = 0;
-                for(int k = 0; k < ref.length(); k++){
-                // for each ref char
-                    {
-                        // for each strain
-                        if(sp.string_sequences[i*2+y][k+pos] != "."){
-                            // decision in this area has already been made
-                            if(k >= alts[y].length()){
-                                // should be a deletion
-                                choice_applicable = false;
-                                break;
-                            }else{
-                                // should be equal at current position
-                                // can be an insertion, as long as current position is the same
-                                if(ref[k] != alts[y][k]){
-                                    choice_applicable = false;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    if(!choice_applicable) break;
-                }
+// a single list is extended breadth first, so it reaches the sync point in order of decision number,
+// then frontier index, and the first of equal paths is kept, see ExtendPathsInParallel
+bool FoundEarlier(const SequencePath & a, const SequencePath & b){
+    if(a.decision_num != b.decision_num) return a.decision_num < b.decision_num;
+    return a.frontier_index < b.frontier_index;
+}
 
-                if(choice_applicable){
-                    candidate_choices[i].push_back(pair<int, int>(var_index, 1));
-                }
+// split the frontier of a huge cluster into contiguous parts, extend them on all threads and
+// converge each part, then order the concatenation as extending the whole list would, so the
+// caller keeps the same paths and best path for any thread number
+bool WholeGenome::ExtendPathsInParallel(int thread_index,
+                                        list<SequencePath> & current_path_list,
+                                        list<SequencePath> & next_path_list,
+                                        SequencePath & best_path,
+                                        vector<DiploidVariant> & variant_list,
+                                        string & subsequence,
+                                        DecisionIndex & decision_index,
+                                        vector<int> & sync_points,
+                                        int score_unit,
+                                        int match_mode,
+                                        int score_scheme,
+                                        long long & path_num,
+                                        int & max_path_list_size,
+                                        long long & path_memory){
+    int worker_num = min(thread_num, (int)current_path_list.size());
+    int part_size = (current_path_list.size() + worker_num - 1) / worker_num;
+
+    vector<list<SequencePath> > current_lists(worker_num);
+    vector<list<SequencePath> > next_lists(worker_num);
+    vector<SequencePath> best_paths(worker_num, best_path);
+    vector<long long> path_nums(worker_num, 0);
+    vector<int> max_path_list_sizes(worker_num, 0);
+    vector<long long> path_memories(worker_num, path_memory);
+    vector<int> budget_exceeded(worker_num, 0);
+    int frontier_index = 0;
+    for(list<SequencePath>::iterator i = current_path_list.begin(); i != current_path_list.end(); ++i){
+        i->frontier_index = frontier_index++;
+        i->decision_num = 0;
+    }
+    for(int w = 0; w < worker_num; w++){
+        list<SequencePath>::iterator part_end = current_path_list.begin();
+        advance(part_end, min(part_size, (int)current_path_list.size()));
+        current_lists[w].splice(current_lists[w].begin(), current_path_list, current_path_list.begin(), part_end);
+    }
+
+    ThreadPool::Shared().ParallelFor(worker_num, [&](int w){
+        budget_exceeded[w] = ExtendPathsToSyncPoint(thread_index,
+                                                    worker_num,
+                                                    current_lists[w],
+                                                    next_lists[w],
+                                                    best_paths[w],
+                                                    variant_list,
+                                                    subsequence,
+                                                    decision_index,
+                                                    sync_points,
+                                                    score_unit,
+                                                    match_mode,
+                                                    score_scheme,
+                                                    path_nums[w],
+                                                    max_path_list_sizes[w],
+                                                    path_memories[w]);
+        ConvergePaths(next_lists[w]);
+    });
+
+    bool exceeded = false;
+    int frontier_size = 0;
+    int best_w = -1;
+    for(int w = 0; w < worker_num; w++){
+        next_path_list.splice(next_path_list.end(), next_lists[w]);
+        // best_paths[w] keeps the incoming best path unless a higher score is found
+        if(best_paths[w].score > best_path.score ||
+           (best_w >= 0 && best_paths[w].score == best_path.score && FoundEarlier(best_paths[w], best_path))){
+            best_path = best_paths[w];
+            best_w = w;
+        }
+        path_num += path_nums[w];
+        frontier_size += max_path_list_sizes[w];
+        path_memory = max(path_memory, path_memories[w]);
+        if(budget_exceeded[w]) exceeded = true;
+    }
+    next_path_list.sort(FoundEarlier);
+    max_path_list_size = max(max_path_list_size, frontier_size);
+    return exceeded;
+}
 
+// every allele of every variant is a single base, and baseline and query have at most one variant per position
+bool WholeGenome::IsSnpCluster(vector<DiploidVariant> & variant_list){
+    for(int i = 0; i < variant_list.size(); i++){
+        DiploidVariant & var = variant_list[i];
+        if(var.ref.length() != 1) return false;
+        for(int k = 0; k < var.alts.size(); k++){
+            if(var.alts[k].length() != 1) return false;
+        }
+        // variant_list is sorted by position
+        for(int j = i + 1; j < variant_list.size() && variant_list[j].pos == var.pos; j++){
+            if(variant_list[j].flag == var.flag) return false;
+        }
+    }
+    return true;
+}
 
-                alts[0] = ref;
-                alts[1] = var.alts[1];
-
-                choice_applicable = true;
-                y = 1;
-                for(int k = 0; k < ref.length(); k++){
-                // for each ref char
-                    {
-                        // for each strain
-                        if(sp.string_sequences[i*2+y][k+pos] != "."){
-                            // decision in this area has already been made
-                            if(k >= alts[y].length()){
-                                // should be a deletion
-                                choice_applicable = false;
-                                break;
-                            }else{
-                                // should be equal at current position
-                                // can be an insertion, as long as current position is the same
-                                if(ref[k] != alts[y][k]){
-                                    choice_applicable = false;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    if(!choice_applicable) break;
-                }
+// same test on a whole cluster, clusters filtered by quality thresholds stay SNP-only
+bool WholeGenome::IsSnpCluster(vector<VariantIndicator> & vi_list){
+    vector<pair<int, bool> > positions;
+    for(int i = 0; i < vi_list.size(); i++){
+        VariantIndicator & vi = vi_list[i];
+        DiploidVariant & var = vi.refer ? ref_variant_by_chrid[vi.chr_id]->at(vi.var_id) : que_variant_by_chrid[vi.chr_id]->at(vi.var_id);
+        if(var.ref.length() != 1) return false;
+        for(int k = 0; k < var.alts.size(); k++){
+            if(var.alts[k].length() != 1) return false;
+        }
+        positions.push_back(make_pair(var.pos, var.flag));
+    }
+    sort(positions.begin(), positions.end());
+    return adjacent_find(positions.begin(), positions.end()) == positions.end();
+}
 
-                if(choice_applicable){
-                    candidate_choices[i].push_back(pair<int, int>(var_index, -2));
-                }
-            }
+// choices VariantMakeDecision or VariantMakeDecisionNoGenotype create for a variant on a free position, in the same order
+void WholeGenome::SnpVariantChoices(DiploidVariant & var, bool phasing_symmetric, int match_mode, vector<int> & choices){
+    choices.clear();
+    choices.push_back(int(NOT_USE));
+    choices.push_back(0);
+    if(match_mode == 1){
+        if(var.multi_alts) choices.push_back(1);
+        return;
+    }
+    if(var.heterozygous && !phasing_symmetric){
+        if(var.multi_alts && !var.zero_one_var){
+            choices.push_back(1);
+        }else{
+            choices.push_back(-1);
+        }
+    }
+    if(var.multi_alts && var.zero_one_var){
+        choices.push_back(1);
+        if(!phasing_symmetric) choices.push_back(-2);
+    }
+}
+
+// alt index on each haplotype for a choice, as in AppendChangedSp, -1 keeps reference
+void WholeGenome::SnpChoiceAltIndexes(DiploidVariant & var, int c, int match_mode, int alt_indexes[]){
+    alt_indexes[0] = -1;
+    alt_indexes[1] = -1;
+    if(c == NOT_USE) return;
+    if(match_mode == 1){
+        alt_indexes[0] = c;
+        return;
+    }
+    if(c == -1){
+        alt_indexes[1] = 0;
+    }else if(c == -2){
+        alt_indexes[1] = 1;
+    }else{
+        alt_indexes[0] = c;
+        alt_indexes[1] = c;
+        if(var.multi_alts && !var.zero_one_var){
+            alt_indexes[1] = 1 - c;
+        }else if(var.heterozygous){
+            alt_indexes[1] = -1;
         }
     }
+}
 
-    //dout << candidate_choices[0].size() << "," << candidate_choices[1].size() << endl;
+// paths of a SNP cluster have equal donor lengths everywhere, so they all converge at each variant position
+// and MatchingSingleClusterBaseExtending keeps the first highest scoring pair of choices per position.
+// positions are independent of each other except for phasing symmetry, so every position of the batch
+// is matched for both symmetry states at once and each cluster then walks its own positions
+void WholeGenome::AddSnpCluster(SnpClusterBatch & batch,
+                                int threshold_index,
+                                int chr_id,
+                                vector<DiploidVariant> & variant_list,
+                                string & subsequence,
+                                int offset){
+    SnpCluster cluster;
+    cluster.threshold_index = threshold_index;
+    cluster.chr_id = chr_id;
+    cluster.direct = false;
+    cluster.variant_list = variant_list;
+    cluster.subsequence = subsequence;
+    cluster.offset = offset;
+    cluster.position_start = batch.position_num();
+    int start = 0;
+    while(start < variant_list.size()){
+        // variants at this position, baseline and query
+        int var_index[2] = {-1, -1};
+        int end = start;
+        for(; end < variant_list.size() && variant_list[end].pos == variant_list[start].pos; end++){
+            var_index[variant_list[end].flag ? 1 : 0] = end;
+        }
+        batch.var_index[0].push_back(var_index[0]);
+        batch.var_index[1].push_back(var_index[1]);
+        batch.reference_base.push_back(subsequence[variant_list[start].pos - offset]);
+        start = end;
+    }
+    cluster.position_end = batch.position_num();
+    cluster.stat_index = -1;
+    batch.clusters.push_back(cluster);
+}
 
-    for(int i = 0; i < candidate_choices[0].size(); i++){
-        for(int j = 0; j < candidate_choices[1].size(); j++){
-            // iterate all choices
-            SequencePath path = sp;
-            pair<int, int> var_choice[2];
-            var_choice[0] = candidate_choices[0][i];
-            var_choice[1] = candidate_choices[1][j];
+void WholeGenome::FillSnpChoiceTable(SnpClusterBatch & batch,
+                                     int score_unit,
+                                     int match_mode,
+                                     int score_scheme){
+    int position_num = batch.position_num();
+    int table_size = 2 * 2 * SnpClusterBatch::MAX_CHOICE_NUM * position_num;
+    batch.choice_num.assign(2 * 2 * position_num, 0);
+    batch.choice_value.assign(table_size, int(NOT_USE));
+    batch.choice_allele[0].assign(table_size, 0);
+    batch.choice_allele[1].assign(table_size, 0);
+    batch.choice_score.assign(table_size, 0);
+    batch.choice_keeps_symmetry.assign(table_size, 1);
+
+    vector<int> choices;
+    for(int k = 0; k < batch.clusters.size(); k++){
+        SnpCluster & cluster = batch.clusters[k];
+        if(cluster.direct) continue;
+        for(int p = cluster.position_start; p < cluster.position_end; p++){
             for(int x = 0; x < 2; x++){
-                // iterate truth and predict
-                int var_index = var_choice[x].first;
-                if(var_index != -1){
-//                    string temp_sequence = reference_sequence.substr(pos, 1);
-//                    path.string_sequences[x*2][pos] = temp_sequence;
-//                    path.string_sequences[x*2+1][pos] = temp_sequence;
-//                }else{
-                    // set score
-
-
-                    DiploidVariant var = variant_list[var_index];
-                    // if(var.flag != x){
-                    //     dout << "Error" << endl;
-                    // }
-                    string ref = var.ref;
-                    string alts[2];
-
-                    int c = var_choice[x].second;
-                    if(c == -1){
-                        alts[0] = ref;
-                        alts[1] = var.alts[0];
-                    }else if(c == -2){
-                        alts[0] = ref;
-                        alts[1] = var.alts[1];
+                int var_index = batch.var_index[x][p];
+                for(int s = 0; s < 2; s++){
+                    if(var_index < 0){
+                        choices.assign(1, int(NOT_USE));
                     }else{
-                        // c == 0 or 1
-                        alts[0] = var.alts[c];
-                        alts[1] = alts[0];
-
-                        if(var.multi_alts && !var.zero_one_var){
-                            // choose 1 or 0
-                            alts[1] = var.alts[1- c];
-                        }else{
-                            // c is 0, choose 0 or -1
-                            if(var.heterozygous) alts[1] = ref;
-                        }
+                        SnpVariantChoices(cluster.variant_list[var_index], s == 1, match_mode, choices);
                     }
-
-                    path.score += CalculateScore(var,
-                                                 c,
-                                                 score_unit,
-                                                 match_mode,
-                                                 score_scheme);
-
-                    ToUpper(ref);
-                    ToUpper(alts[0]);
-                    ToUpper(alts[1]);
-                    for(int y = 0; y < 2; y++){
-                        // iterate two alts
-                        string alt = alts[y];
-                        vector<string> alt_vector;
-                        GenerateAltVector(ref, alt, alt_vector);
-
-                        int k = 0;
-                        for(; k < ref.length()-1; k++){
-
-                            if(alt_vector[k].size() != 1 || ref[k] != alt_vector[k][0]){
-                                path.string_sequences[x*2+y][pos+k] = alt_vector[k];
+                    batch.choice_num[(x * 2 + s) * position_num + p] = choices.size();
+                    for(int c = 0; c < choices.size(); c++){
+                        int t = batch.TableIndex(x, s, c, p);
+                        batch.choice_value[t] = choices[c];
+                        batch.choice_allele[0][t] = batch.reference_base[p];
+                        batch.choice_allele[1][t] = batch.reference_base[p];
+                        if(var_index < 0) continue;
+                        DiploidVariant & var = cluster.variant_list[var_index];
+                        int alt_indexes[2];
+                        SnpChoiceAltIndexes(var, choices[c], match_mode, alt_indexes);
+                        for(int y = 0; y < 2; y++){
+                            if(alt_indexes[y] >= 0 && var.alts[alt_indexes[y]] != var.ref){
+                                batch.choice_allele[y][t] = var.alts[alt_indexes[y]][0];
                             }
-                            // else changes nothing
-
                         }
-                        // hence k == ref.length()-1, the last position
-                        assert(k == ref.length()-1);
-                        string alt_part = alt_vector[k];
-                        if(alt_part.length() > 0){
-                            if(alt_part.length() > 1){
-                                if(alt_part[0] == ref[k]){
-                                    if(path.string_sequences[x*2+y][pos+k] == "."){
-                                        path.string_sequences[x*2+y][pos+k] = alt_part;
-                                    }else{
-                                        path.string_sequences[x*2+y][pos+k] += alt_part.substr(1, alt_part.size() - 1);
-                                    }
-                                }else{
-                                    path.string_sequences[x*2+y][pos+k] = alt_part;
-                                }
-                            }else{
-                                if(ref[k] != alt_vector[k][0]){
-                                    path.string_sequences[x*2+y][pos+k] = alt_part;
-                                }
-                            }
-                        }else{
-                            path.string_sequences[x*2+y][pos+k] = "";
+                        batch.choice_score[t] = CalculateScore(var, choices[c], score_unit, match_mode, score_scheme);
+                        if(choices[c] != NOT_USE && match_mode == 0 && alt_indexes[0] != alt_indexes[1]){
+                            batch.choice_keeps_symmetry[t] = 0;
                         }
                     }
                 }
-                path.choice_made[x][pos] = var_choice[x];
             }
-            // choice made
-            dout << "after decision at pos " << pos << endl;
-            PrintPath(path);
-            sequence_path_list.push_back(path);
         }
     }
+}
 
-    //expected number of inserted paths are 2,3,4,6,x...
-    return true;
+// x1 where mask has all bits set, x0 where mask is 0
+static inline int SelectByMask(int x0, int x1, int mask){
+    return x0 ^ ((x0 ^ x1) & mask);
 }
 
-bool WholeGenome::PathMakeDecisionBackup(SequencePath& sp,
-                                 vector<DiploidVariant> & variant_list,
-                                 multimap<int, int> * choices_by_pos[],
-                                 list<SequencePath> & sequence_path_list,
-                                 const string & reference_sequence,
-                                 int score_unit,
-                                 int match_mode,
-                                 int score_scheme)
-{
-    //expected number of inserted paths are 2,3,4,6,x...
-    return true;
+// one pair of choices, baseline choice a and query choice b, on every position of a batch.
+// the loop has no branches and its arrays do not overlap, so that the compiler vectorizes it over positions.
+// query choices are read from the symmetry state the baseline choice leaves
+static void MatchSnpChoicePair(int position_num,
+                               int a,
+                               int b,
+                               int s,
+                               const int * __restrict truth_num,
+                               const int * __restrict truth_value,
+                               const int * __restrict truth_allele0,
+                               const int * __restrict truth_allele1,
+                               const int * __restrict truth_score,
+                               const int * __restrict truth_keeps,
+                               const int * __restrict query_num0,
+                               const int * __restrict query_num1,
+                               const int * __restrict query_value0,
+                               const int * __restrict query_value1,
+                               const int * __restrict query_allele00,
+                               const int * __restrict query_allele01,
+                               const int * __restrict query_allele10,
+                               const int * __restrict query_allele11,
+                               const int * __restrict query_score0,
+                               const int * __restrict query_score1,
+                               const int * __restrict query_keeps0,
+                               const int * __restrict query_keeps1,
+                               int * __restrict best_truth_choice,
+                               int * __restrict best_query_choice,
+                               int * __restrict best_score,
+                               int * __restrict next_symmetric){
+    for(int p = 0; p < position_num; p++){
+        int ts = s & truth_keeps[p];
+        int ts_mask = -ts;
+        int num = SelectByMask(query_num0[p], query_num1[p], ts_mask);
+        int value = SelectByMask(query_value0[p], query_value1[p], ts_mask);
+        int allele0 = SelectByMask(query_allele00[p], query_allele01[p], ts_mask);
+        int allele1 = SelectByMask(query_allele10[p], query_allele11[p], ts_mask);
+        int score = truth_score[p] + SelectByMask(query_score0[p], query_score1[p], ts_mask);
+        int keeps = SelectByMask(query_keeps0[p], query_keeps1[p], ts_mask);
+
+        int valid = (a < truth_num[p]) & (b < num);
+        int equal = (truth_allele0[p] == allele0) & (truth_allele1[p] == allele1);
+        int better_mask = -(valid & equal & (score > best_score[p]));
+        best_score[p] = SelectByMask(best_score[p], score, better_mask);
+        best_truth_choice[p] = SelectByMask(best_truth_choice[p], truth_value[p], better_mask);
+        best_query_choice[p] = SelectByMask(best_query_choice[p], value, better_mask);
+        next_symmetric[p] = SelectByMask(next_symmetric[p], ts & keeps, better_mask);
+    }
 }
 
-void WholeGenome::PrintPath(SequencePath & sp){
-    cout << "- Sequence Path:" << endl;
-    cout << "@ String Sequences:" << endl;
-    for(int i = 0; i < 4; i++){
-        for(int j = 0; j < sp.string_sequences[i].size(); j++){
-            cout << sp.string_sequences[i][j] << " ";
+// pairs of choices are tried in the order the path engine creates them, one pair over all positions at a time,
+// and a pair replaces the best one only with a higher score
+void WholeGenome::MatchSnpPositions(SnpClusterBatch & batch){
+    const int N = SnpClusterBatch::MAX_CHOICE_NUM;
+    int position_num = batch.position_num();
+    batch.best_choice[0].resize(2 * position_num);
+    batch.best_choice[1].resize(2 * position_num);
+    batch.best_score.resize(2 * position_num);
+    batch.next_symmetric.resize(2 * position_num);
+
+    for(int s = 0; s < 2; s++){
+        int * best_truth_choice = &batch.best_choice[0][s * position_num];
+        int * best_query_choice = &batch.best_choice[1][s * position_num];
+        int * best_score = &batch.best_score[s * position_num];
+        int * next_symmetric = &batch.next_symmetric[s * position_num];
+
+        // both variants not used always comes first and keeps the state
+        int t = batch.TableIndex(0, s, 0, 0);
+        int q = batch.TableIndex(1, s, 0, 0);
+        for(int p = 0; p < position_num; p++){
+            best_truth_choice[p] = NOT_USE;
+            best_query_choice[p] = NOT_USE;
+            best_score[p] = batch.choice_score[t + p] + batch.choice_score[q + p];
+            next_symmetric[p] = s;
+        }
+
+        for(int a = 0; a < N; a++){
+            t = batch.TableIndex(0, s, a, 0);
+            for(int b = 0; b < N; b++){
+                if(a == 0 && b == 0) continue;
+                int q0 = batch.TableIndex(1, 0, b, 0);
+                int q1 = batch.TableIndex(1, 1, b, 0);
+                MatchSnpChoicePair(position_num, a, b, s,
+                                   &batch.choice_num[(0 * 2 + s) * position_num],
+                                   &batch.choice_value[t],
+                                   &batch.choice_allele[0][t],
+                                   &batch.choice_allele[1][t],
+                                   &batch.choice_score[t],
+                                   &batch.choice_keeps_symmetry[t],
+                                   &batch.choice_num[(1 * 2 + 0) * position_num],
+                                   &batch.choice_num[(1 * 2 + 1) * position_num],
+                                   &batch.choice_value[q0],
+                                   &batch.choice_value[q1],
+                                   &batch.choice_allele[0][q0],
+                                   &batch.choice_allele[0][q1],
+                                   &batch.choice_allele[1][q0],
+                                   &batch.choice_allele[1][q1],
+                                   &batch.choice_score[q0],
+                                   &batch.choice_score[q1],
+                                   &batch.choice_keeps_symmetry[q0],
+                                   &batch.choice_keeps_symmetry[q1],
+                                   best_truth_choice,
+                                   best_query_choice,
+                                   best_score,
+                                   next_symmetric);
+            }
         }
-        cout << endl;
     }
-    cout << "@ Donor Sequences:" << endl;
-    for(int i = 0; i < 4; i++){
-        cout << sp.donor_sequences[i] << endl;
+}
+
+// records are added in the order clusters entered the batch, then the batch is emptied
+void WholeGenome::MatchSnpClusterBatch(int thread_index, SnpClusterBatch & batch){
+    if(batch.clusters.empty()) return;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    int position_num = batch.position_num();
+
+    for(int i = 0; i < score_unit_list.size(); i++){
+        for(int j = 0; j < match_mode_list.size(); j++){
+            for(int k = 0; k < score_scheme_list.size(); k++){
+                FillSnpChoiceTable(batch, score_unit_list[i], match_mode_list[j], score_scheme_list[k]);
+                MatchSnpPositions(batch);
+                for(int c = 0; c < batch.clusters.size(); c++){
+                    SnpCluster & cluster = batch.clusters[c];
+                    if(cluster.direct) continue;
+                    int s = MirrorChoicesEquivalent(cluster.variant_list, score_unit_list[i], match_mode_list[j]) ? 1 : 0;
+                    vector<int> choices(cluster.variant_list.size(), int(NOT_USE));
+                    int score = 0;
+                    for(int p = cluster.position_start; p < cluster.position_end; p++){
+                        int lane = s * position_num + p;
+                        for(int x = 0; x < 2; x++){
+                            if(batch.var_index[x][p] >= 0) choices[batch.var_index[x][p]] = batch.best_choice[x][lane];
+                        }
+                        score += batch.best_score[lane];
+                        s = batch.next_symmetric[lane];
+                    }
+                    cluster.best_choices.push_back(choices);
+                    cluster.best_scores.push_back(score);
+                }
+            }
+        }
     }
-    cout << "@ Removable: " << sp.removable << endl;
 
-    for(int i = 0; i < sp.choice_vector.size(); i++){
-        cout << sp.choice_vector[i] << ",";
+    for(int c = 0; c < batch.clusters.size(); c++){
+        SnpCluster & cluster = batch.clusters[c];
+        if(cluster.direct){
+            AddDirectMatchRecord(thread_index, cluster.threshold_index, cluster.chr_id, cluster.variant_list[0]);
+            continue;
+        }
+        int m = 0;
+        for(int i = 0; i < score_unit_list.size(); i++){
+            for(int j = 0; j < match_mode_list.size(); j++){
+                for(int k = 0; k < score_scheme_list.size(); k++, m++){
+                    if(cluster.best_scores[m] <= 0) continue;
+                    int match_mode = match_mode_list[j];
+                    vector<DiploidVariant> & variant_list = cluster.variant_list;
+                    SequencePath best_path(cluster.subsequence.length(), variant_list.size());
+                    for(int v = 0; v < variant_list.size(); v++){
+                        DiploidVariant & var = variant_list[v];
+                        int choice = cluster.best_choices[m][v];
+                        best_path.choice_vector.set(v, choice);
+                        int alt_indexes[2];
+                        SnpChoiceAltIndexes(var, choice, match_mode, alt_indexes);
+                        int index = var.flag ? 1 : 0;
+                        for(int y = 0; y < 2; y++){
+                            if(alt_indexes[y] >= 0 && var.alts[alt_indexes[y]] != var.ref){
+                                best_path.SetSequence(index*2+y, var.pos - cluster.offset, var.alts[alt_indexes[y]]);
+                            }
+                        }
+                    }
+                    best_path.score = cluster.best_scores[m];
+                    best_path.current_genome_pos = cluster.subsequence.length() - 1;
+
+                    int mode_index = GetIndexFromMatchScore(score_unit_list[i], match_mode, score_scheme_list[k]);
+                    if(match_mode == 0){
+                        ConstructMatchRecord(best_path,
+                                             variant_list,
+                                             cluster.subsequence,
+                                             cluster.offset,
+                                             thread_index,
+                                             cluster.chr_id,
+                                             mode_index,
+                                             cluster.threshold_index);
+                    }else{
+                        ConstructMatchRecordNoGenotype(best_path,
+                                                       variant_list,
+                                                       cluster.subsequence,
+                                                       cluster.offset,
+                                                       thread_index,
+                                                       cluster.chr_id,
+                                                       mode_index,
+                                                       cluster.threshold_index);
+                    }
+                }
+            }
+        }
     }
-    cout << endl;
+
+    // the time of the batch is split by positions, and a unit per cluster for its records
+    chrono::duration<double> batch_time = chrono::steady_clock::now() - begin;
+    double unit_seconds = batch_time.count() / (position_num + batch.clusters.size());
+    for(int c = 0; c < batch.clusters.size(); c++){
+        SnpCluster & cluster = batch.clusters[c];
+        if(cluster.stat_index < 0) continue;
+        batch.cluster_stats[cluster.stat_index].seconds += unit_seconds * (cluster.position_end - cluster.position_start + 1);
+    }
+    cluster_stats_by_thread[thread_index]->insert(cluster_stats_by_thread[thread_index]->end(),
+                                                  batch.cluster_stats.begin(),
+                                                  batch.cluster_stats.end());
+
+    batch.clusters.clear();
+    batch.cluster_stats.clear();
+    batch.var_index[0].clear();
+    batch.var_index[1].clear();
+    batch.reference_base.clear();
 }
 
 // next: while until current path list is empty
@@ -2189,13 +2842,14 @@ bool WholeGenome::MatchingSingleClusterBaseExtending(int cluster_index,
                                                     vector<DiploidVariant> & variant_list,
                                                     string & subsequence,
                                                     int offset,
-                                                    multimap<int, int> * choices_by_pos[],
+                                                    DecisionIndex & decision_index,
                                                     vector<int> & sync_points,
                                                     int chr_id,
                                                     int score_unit,
                                                     int match_mode,
                                                     int score_scheme,
-                                                    int threshold_index){
+                                                    int threshold_index,
+                                                    bool & budget_exceeded){
     //--------------for unit test------------------------------
     //dout << variant_list.size() << endl;
 
@@ -2211,75 +2865,50 @@ bool WholeGenome::MatchingSingleClusterBaseExtending(int cluster_index,
     list<SequencePath> current_path_list;
     list<SequencePath> next_path_list;
     SequencePath sp(subsequence.length(), variant_list.size());
+    InitializeLengthBalance(sp, variant_list, decision_index);
+    sp.phasing_symmetric = MirrorChoicesEquivalent(variant_list, score_unit, match_mode);
     SequencePath best_path = sp;
     current_path_list.push_back(sp);
-    while(current_path_list.size() != 0){
-        bool reach_sync_point = true;
+    long long path_num = 0;
+    int max_path_list_size = 0;
+    long long path_memory = PathMemory(sp);
+    budget_exceeded = false;
+    while(current_path_list.size() != 0 && !budget_exceeded){
         // extend path before reaches sync points
         //cout << "\t" << current_path_list.size() << endl;
-        while(current_path_list.size() != 0){
-            SequencePath path = current_path_list.front();
-            current_path_list.pop_front();
-            //dout << path.current_genome_pos << ":" << current_path_list.size() << endl;
-            //PrintPath(path);
-            int variant_need_decision = -1;
-            int is_extend = PathExtendOneStep(path, choices_by_pos, subsequence, sync_points, match_mode, variant_need_decision);
-            //cout << variant_need_decision << endl;
-            //PrintPath(path);
-            if(is_extend == -1){
-                // discard path
-                continue;
-            }
-            else if(is_extend == 0){
-                next_path_list.push_back(path);
-                // here the path is supposed to reach the next sync point
-                // so it goes into next path list, and decrease the number of current path list
-            }else if(is_extend == 1){
-                if(match_mode == 0){
-                    // PathMakeDecision(path,
-                    //                  variant_list,
-                    //                  choices_by_pos,
-                    //                  current_path_list,
-                    //                  subsequence,
-                    //                  score_unit,
-                    //                  match_mode,
-                    //                  score_scheme);
-
-                    VariantMakeDecision(path,
-                                         variant_list,
-                                         current_path_list,
-                                         subsequence,
-                                         score_unit,
-                                         match_mode,
-                                         score_scheme,
-                                         variant_need_decision);
-                }else{
-                    // PathMakeDecisionNoGenotype(path,
-                    //                            variant_list,
-                    //                            choices_by_pos,
-                    //                            current_path_list,
-                    //                            subsequence,
-                    //                            score_unit,
-                    //                            match_mode,
-                    //                            score_scheme);
-
-                    VariantMakeDecisionNoGenotype(path,
-                                                 variant_list,
-                                                 current_path_list,
-                                                 subsequence,
-                                                 score_unit,
-                                                 match_mode,
-                                                 score_scheme,
-                                                 variant_need_decision);
-                }
-            }else if(is_extend == 2){
-                if(path.score > best_path.score){
-                    best_path = path; // only when you reach the very end can you be considered as best path
-                    //PrintPath(best_path);
-                }
-            }
+        if(expand_paths_in_parallel && thread_num > 1 && current_path_list.size() > 1){
+            budget_exceeded = ExtendPathsInParallel(thread_index,
+                                                    current_path_list,
+                                                    next_path_list,
+                                                    best_path,
+                                                    variant_list,
+                                                    subsequence,
+                                                    decision_index,
+                                                    sync_points,
+                                                    score_unit,
+                                                    match_mode,
+                                                    score_scheme,
+                                                    path_num,
+                                                    max_path_list_size,
+                                                    path_memory);
+        }else{
+            budget_exceeded = ExtendPathsToSyncPoint(thread_index,
+                                                     1,
+                                                     current_path_list,
+                                                     next_path_list,
+                                                     best_path,
+                                                     variant_list,
+                                                     subsequence,
+                                                     decision_index,
+                                                     sync_points,
+                                                     score_unit,
+                                                     match_mode,
+                                                     score_scheme,
+                                                     path_num,
+                                                     max_path_list_size,
+                                                     path_memory);
         }
-        current_path_list = next_path_list;
+        current_path_list.swap(next_path_list);
         next_path_list.clear();
         if(current_path_list.size() > 0){
             //int current_genome_pos = current_path_list.front().current_genome_pos;
@@ -2294,6 +2923,13 @@ bool WholeGenome::MatchingSingleClusterBaseExtending(int cluster_index,
     }
     current_path_list.clear();
     next_path_list.clear();
+    ClusterStat & cs = current_cluster_stat_by_thread[thread_index];
+    cs.path_num += path_num;
+    cs.max_path_list_size = max(cs.max_path_list_size, max_path_list_size);
+    if(budget_exceeded){
+        cs.budget_exceeded = true;
+        return false;
+    }
     // print best_path
     if(best_path.score <= 0) return false;
 
@@ -2327,19 +2963,196 @@ bool WholeGenome::MatchingSingleClusterBaseExtending(int cluster_index,
     return true;
 }
 
-int GetMatchmodeFromModeIndex(int mode_index){
-    int result = mode_index;
-    result >>= 2;
-    result &= 1;
-    return result;
-}
-
-void WholeGenome::ConstructMatchRecord(SequencePath & best_path,
-                                       vector<DiploidVariant> & variant_list,
-                                       string & subsequence,
-                                       int offset,
-                                       int thread_index,
-                                       int chr_id,
+// highest score a variant can contribute, over all choices of the variant
+int WholeGenome::MaxVariantScore(DiploidVariant & dv,
+                                 int score_unit,
+                                 int match_mode,
+                                 int score_scheme){
+    vector<int> choices = {0};
+    if(match_mode == 0){
+        if(dv.heterozygous){
+            if(dv.multi_alts && !dv.zero_one_var){
+                choices.push_back(1);
+            }else{
+                choices.push_back(-1);
+            }
+        }
+        if(dv.multi_alts && dv.zero_one_var){
+            choices.push_back(1);
+            choices.push_back(-2);
+        }
+    }else if(dv.multi_alts){
+        choices.push_back(1);
+    }
+    int max_score = 0;
+    for(int i = 0; i < choices.size(); i++){
+        max_score = max(max_score, CalculateScore(dv, choices[i], score_unit, match_mode, score_scheme));
+    }
+    return max_score;
+}
+
+bool CompareSearchNode(const SearchNode & a, const SearchNode & b){
+    if(a.bound != b.bound) return a.bound < b.bound;
+    if(a.complete != b.complete) return b.complete;
+    return a.order > b.order;
+}
+
+// alternative to MatchingSingleClusterBaseExtending
+// paths are expanded in order of score plus the highest score undecided variants can add,
+// as scores are additive per variant, the first complete path taken from the heap is optimal
+bool WholeGenome::MatchingSingleClusterBestFirst(int cluster_index,
+                                                 int thread_index,
+                                                 vector<DiploidVariant> & variant_list,
+                                                 string & subsequence,
+                                                 int offset,
+                                                 DecisionIndex & decision_index,
+                                                 vector<int> & sync_points,
+                                                 int chr_id,
+                                                 int score_unit,
+                                                 int match_mode,
+                                                 int score_scheme,
+                                                 int threshold_index,
+                                                 bool & budget_exceeded){
+    // only variants in decision_index can be decided
+    vector<int> variant_max_score(variant_list.size(), 0);
+    int total_max_score = 0;
+    for(int i = 0; i < 2; i++){
+        for(int k = 0; k < decision_index.variant_indexes[i].size(); k++){
+            int var_index = decision_index.variant_indexes[i][k];
+            variant_max_score[var_index] = MaxVariantScore(variant_list[var_index], score_unit, match_mode, score_scheme);
+            total_max_score += variant_max_score[var_index];
+        }
+    }
+
+    vector<SearchNode> search_heap;
+    // paths reaching a sync point with a converge key seen before are dominated
+    unordered_map<ConvergeKey, bool, ConvergeKeyHash> closed_keys;
+    long long order = 0;
+    SequencePath sp(subsequence.length(), variant_list.size());
+    InitializeLengthBalance(sp, variant_list, decision_index);
+    sp.phasing_symmetric = MirrorChoicesEquivalent(variant_list, score_unit, match_mode);
+    SequencePath best_path = sp;
+    search_heap.push_back(SearchNode(total_max_score, total_max_score, false, order++, sp));
+
+    long long path_num = 0;
+    int max_path_list_size = 0;
+    long long path_memory = PathMemory(sp);
+    budget_exceeded = false;
+    list<SequencePath> decision_path_list;
+    while(search_heap.size() != 0){
+        // no path can have positive score
+        if(search_heap.front().bound <= 0) break;
+        max_path_list_size = max(max_path_list_size, (int)search_heap.size());
+        path_num ++;
+        if(ClusterBudgetExceeded(thread_index, search_heap.size(), path_memory)){
+            budget_exceeded = true;
+            break;
+        }
+        pop_heap(search_heap.begin(), search_heap.end(), CompareSearchNode);
+        SearchNode node = move(search_heap.back());
+        search_heap.pop_back();
+        if(node.complete){
+            best_path = move(node.path);
+            break;
+        }
+
+        SequencePath & path = node.path;
+        int variant_need_decision = -1;
+        int is_extend = PathExtendOneStep(path, decision_index, subsequence, sync_points, match_mode, variant_need_decision);
+        if(is_extend == -1){
+            continue;
+        }else if(is_extend == 0){
+            if(path.same_donor_len){
+                ConvergeKey key = GetConvergeKey(path);
+                if(closed_keys.find(key) != closed_keys.end()) continue;
+                closed_keys[key] = true;
+            }
+            node.order = order++;
+            search_heap.push_back(move(node));
+            push_heap(search_heap.begin(), search_heap.end(), CompareSearchNode);
+        }else if(is_extend == 1){
+            if(match_mode == 0){
+                VariantMakeDecision(path,
+                                    variant_list,
+                                    decision_path_list,
+                                    subsequence,
+                                    score_unit,
+                                    match_mode,
+                                    score_scheme,
+                                    variant_need_decision);
+            }else{
+                VariantMakeDecisionNoGenotype(path,
+                                              variant_list,
+                                              decision_path_list,
+                                              subsequence,
+                                              score_unit,
+                                              match_mode,
+                                              score_scheme,
+                                              variant_need_decision);
+            }
+            int remaining = node.remaining - variant_max_score[variant_need_decision];
+            for(auto it = decision_path_list.begin(); it != decision_path_list.end(); ++it){
+                int bound = it->score + remaining;
+                search_heap.push_back(SearchNode(bound, remaining, false, order++, move(*it)));
+                push_heap(search_heap.begin(), search_heap.end(), CompareSearchNode);
+            }
+            decision_path_list.clear();
+        }else if(is_extend == 2){
+            node.bound = path.score;
+            node.remaining = 0;
+            node.complete = true;
+            node.order = order++;
+            search_heap.push_back(move(node));
+            push_heap(search_heap.begin(), search_heap.end(), CompareSearchNode);
+        }
+        path_memory = PathMemory(path);
+    }
+    search_heap.clear();
+    ClusterStat & cs = current_cluster_stat_by_thread[thread_index];
+    cs.path_num += path_num;
+    cs.max_path_list_size = max(cs.max_path_list_size, max_path_list_size);
+    if(budget_exceeded){
+        cs.budget_exceeded = true;
+        return false;
+    }
+    if(best_path.score <= 0) return false;
+
+    int mode_index = GetIndexFromMatchScore(score_unit, match_mode, score_scheme);
+    if(match_mode == 0){
+        ConstructMatchRecord(best_path,
+                             variant_list,
+                             subsequence,
+                             offset,
+                             thread_index,
+                             chr_id,
+                             mode_index,
+                             threshold_index);
+    }else{
+        ConstructMatchRecordNoGenotype(best_path,
+                                       variant_list,
+                                       subsequence,
+                                       offset,
+                                       thread_index,
+                                       chr_id,
+                                       mode_index,
+                                       threshold_index);
+    }
+    return true;
+}
+
+int GetMatchmodeFromModeIndex(int mode_index){
+    int result = mode_index;
+    result >>= 2;
+    result &= 1;
+    return result;
+}
+
+void WholeGenome::ConstructMatchRecord(SequencePath & best_path,
+                                       vector<DiploidVariant> & variant_list,
+                                       string & subsequence,
+                                       int offset,
+                                       int thread_index,
+                                       int chr_id,
                                        int mode_index,
                                        int threshold_index){
     int truth_num = 0;
@@ -2351,6 +3164,7 @@ void WholeGenome::ConstructMatchRecord(SequencePath & best_path,
 
     if (threshold_index == 0) need_match_record = true;
 
+    RebuildDonorSequences(best_path, subsequence);
     bool multiple_match = false;
 
     if(best_path.donor_sequences[0] != best_path.donor_sequences[1]) multiple_match = true;
@@ -2472,6 +3286,7 @@ void WholeGenome::ConstructMatchRecordNoGenotype(SequencePath & best_path,
     bool need_match_record = false;
     if(threshold_index == 0) need_match_record = true;
 
+    RebuildDonorSequences(best_path, subsequence);
     bool multiple_match = false;
     string parsimonious_ref = subsequence;
     string parsimonious_alt0 = best_path.donor_sequences[0];
@@ -2549,266 +3364,39 @@ void WholeGenome::ConstructMatchRecordNoGenotype(SequencePath & best_path,
     query_total_edit_distance[thread_index][threshold_index]->at(mode_index) += predict_edit_distance;
 }
 
-// function no longer used, backup old method
-void WholeGenome::ConstructMatchRecordBackup(SequencePath & best_path,
-                                       vector<DiploidVariant> & variant_list,
-                                       string & subsequence,
-                                       int offset,
-                                       int thread_index,
-                                       int chr_id,
-                                       int mode_index,
-                                       int threshold_index){
-    int truth_num = 0;
-    int predict_num = 0;
-
-    bool need_match_record = false;
-
-    if (threshold_index == 0) need_match_record = true;
-
-    bool multiple_match = false;
-
-    if(best_path.donor_sequences[0] != best_path.donor_sequences[1]) multiple_match = true;
-
-    string parsimonious_ref = subsequence;
-    string parsimonious_alt0 = best_path.donor_sequences[0];
-    string parsimonious_alt1 = best_path.donor_sequences[1];
-
-    int parsimonious_pos = offset;
-//    NormalizeVariantSequence(offset,
-//                             parsimonious_ref,
-//                             parsimonious_alt0,
-//                             parsimonious_alt1,
-//                             chr_id);
-
-    string match_record = chrname_by_chrid[chr_id] + "\t" + to_string(parsimonious_pos+1) + "\t" + parsimonious_ref + "\t" + parsimonious_alt0;
-    if(multiple_match) match_record += "/" + parsimonious_alt1;
-
-    string vcf_record[2];
-    string phasing_record[2];
-
-	for (int i = 0; i < 2; i++) {
-		for (auto it = best_path.choice_made[i].begin(); it != best_path.choice_made[i].end(); ++it) {
-            pair<int, int> selection = it->second;
-            int phasing = selection.second;
-            if(selection.first == -1) continue;
-            DiploidVariant variant = variant_list[selection.first];
-            if(!variant.flag){
-                truth_num++;
-            }else{
-                predict_num++;
-            }
-
-            if(need_match_record){
-                string alt_string = variant.alts[0];
-                if(variant.multi_alts){
-                    alt_string += "/" + variant.alts[1];
-                }
-                string phasing_string = "";
-                if(phasing == 0){
-                    phasing_string += "1";
-                    if(variant.heterozygous){
-                        if(variant.multi_alts && !variant.zero_one_var){
-                            phasing_string += "|2";
-                        }else{
-                            phasing_string += "|0";
-                        }
-                    }else{
-                        phasing_string += "|1";
-                    }
-                }else if(phasing == 1){
-                    if(variant.multi_alts && !variant.zero_one_var){
-                        phasing_string += "2|1";
-                    }else if(variant.multi_alts && variant.zero_one_var){
-                        phasing_string += "2|0";
-                    }else{
-                        phasing_string += "0|1";
-                    }
-                }else if(phasing == -1){
-                    phasing_string += "0|1";
-                }else if(phasing == -2){
-                    phasing_string += "0|2";
-                }
-                string variant_record = to_string(variant.pos+1) + "," + variant.ref + "," + alt_string;
-                vcf_record[i] += variant_record;
-                phasing_record[i] += phasing_string;
-                vcf_record[i] += ";";
-                phasing_record[i] += ";";
-            }
-		}
-        if(need_match_record){
-            vcf_record[i] = vcf_record[i].substr(0, vcf_record[i].size()-1);
-            phasing_record[i] = phasing_record[i].substr(0, phasing_record[i].size()-1);
-        }
-
-	}
-
-    if(need_match_record){
-    	match_record += "\t" + vcf_record[0] + "\t" + vcf_record[1];
-        match_record += "\t" + phasing_record[0] + "\t" + phasing_record[1];
-    	match_record += "\t" + to_string(best_path.score) + "\n";
-
-    	//complex_match_records[thread_index]->push_back(match_record);
-    	
-        // this line should be recovered
-
-
-        match_records_by_mode_by_thread[thread_index][mode_index]->push_back(match_record);
-    
-
-    }
-
-    baseline_total_match_num[thread_index][threshold_index]->at(mode_index) += truth_num;
-    query_total_match_num[thread_index][threshold_index]->at(mode_index) += predict_num;
-}
-
-void WholeGenome::ConstructMatchRecordNoGenotypeBackup(SequencePath & best_path,
-                                                 vector<DiploidVariant> & variant_list,
-                                                 string & subsequence,
-                                                 int offset,
-                                                 int thread_index,
-                                                 int chr_id,
-                                                 int mode_index,
-                                                 int threshold_index){
-    int truth_num = 0;
-    int predict_num = 0;
-
-    bool need_match_record = false;
-    if(threshold_index == 0) need_match_record = true;
-
-    bool multiple_match = false;
-    string parsimonious_ref = subsequence;
-    string parsimonious_alt0 = best_path.donor_sequences[0];
-    string parsimonious_alt1 = best_path.donor_sequences[0];
-
-    int parsimonious_pos = offset;
-
-//    NormalizeVariantSequence(offset,
-//                             parsimonious_ref,
-//                             parsimonious_alt0,
-//                             parsimonious_alt1,
-//                             chr_id);
-
-    string match_record = chrname_by_chrid[chr_id] + "\t" + to_string(parsimonious_pos+1) + "\t" + parsimonious_ref + "\t" + parsimonious_alt0;
-    //if(multiple_match) match_record += "/" + parsimonious_alt1;
-
-    string vcf_record[2];
-    string phasing_record[2];
-
-	for (int i = 0; i < 2; i++) {
-		for (auto it = best_path.choice_made[i].begin(); it != best_path.choice_made[i].end(); ++it) {
-            pair<int, int> selection = it->second;
-            int phasing = selection.second;
-            if(selection.first == -1) continue;
-            if (phasing == -1) continue;
-            DiploidVariant variant = variant_list[selection.first];
-            if(!variant.flag){
-                truth_num++;
-            }else{
-                predict_num++;
-            }
-
-            if(need_match_record){
-                string alt_string = variant.alts[0];
-                if(variant.multi_alts){
-                    alt_string += "/" + variant.alts[1];
-                }
-                string phasing_string = "";
-                if(phasing == 0){
-                    phasing_string += "1|1";
-                }else if(phasing == 1){
-                    phasing_string += "2|2";
-                }
-                string variant_record = to_string(variant.pos+1) + "," + variant.ref + "," + alt_string;
-                vcf_record[i] += variant_record;
-                phasing_record[i] += phasing_string;
-                vcf_record[i] += ";";
-                phasing_record[i] += ";";
-            }
-		}
-        if(need_match_record){
-            vcf_record[i] = vcf_record[i].substr(0, vcf_record[i].size()-1);
-            phasing_record[i] = phasing_record[i].substr(0, phasing_record[i].size()-1);
-        }
-
-	}
-
-    if(need_match_record){
-	   match_record += "\t" + vcf_record[0] + "\t" + vcf_record[1];
-        match_record += "\t" + phasing_record[0] + "\t" + phasing_record[1];
-	   match_record += "\t" + to_string(best_path.score) + "\n";
-
-	   //complex_match_records[thread_index]->push_back(match_record);
-	
-
-       // this line should be recovered
-       match_records_by_mode_by_thread[thread_index][mode_index]->push_back(match_record);
-    
+bool IsRemovable(SequencePath & s){ return s.removable;}
 
+// haplotypes can be swapped, so donor lengths of each pair are sorted
+ConvergeKey GetConvergeKey(SequencePath & sp){
+    ConvergeKey key;
+    key.genome_pos = sp.current_genome_pos;
+    for(int i = 0; i < 4; i += 2){
+        int first_length = sp.DonorLength(i);
+        int second_length = sp.DonorLength(i+1);
+        key.donor_length[i] = min(first_length, second_length);
+        key.donor_length[i+1] = max(first_length, second_length);
     }
-
-    baseline_total_match_num[thread_index][threshold_index]->at(mode_index) += truth_num;
-    query_total_match_num[thread_index][threshold_index]->at(mode_index) += predict_num;
+    return key;
 }
 
-bool WholeGenome::DonorLengthEqual(SequencePath & a, SequencePath & b){
-    bool truth_same = false;
-    bool query_same = false;
-
-    if(a.donor_sequences[0].length() == b.donor_sequences[0].length() &&
-       a.donor_sequences[1].length() == b.donor_sequences[1].length()){
-        truth_same = true;
-    }
-    else if(a.donor_sequences[0].length() == b.donor_sequences[1].length() &&
-            a.donor_sequences[1].length() == b.donor_sequences[0].length()){
-                truth_same = true;
-            }
-
-
-    if(a.donor_sequences[2].length() == b.donor_sequences[2].length() &&
-       a.donor_sequences[3].length() == b.donor_sequences[3].length()){
-        query_same = true;
-    }
-    else if(a.donor_sequences[2].length() == b.donor_sequences[3].length() &&
-            a.donor_sequences[3].length() == b.donor_sequences[2].length()){
-                query_same = true;
-            }
-
-    if(truth_same && query_same) return true;
-    return false;
-}
-
-bool IsRemovable(SequencePath & s){ return s.removable;}
-
+// among paths with the same converge key, keep the first one with highest score
 void WholeGenome::ConvergePaths(list<SequencePath> & path_list){
     //dout << "===========start converge===================" << endl;
     int path_num = path_list.size();
     if(path_num <= 1) return;
-    for(list<SequencePath>::iterator i = path_list.begin(); i!= path_list.end(); ++i){
-        SequencePath  ref_path = *i;
-        if(ref_path.removable) continue;
-        if(!ref_path.same_donor_len) continue;
-        list<SequencePath>::iterator j = i;
-        ++j;
-        for(; j != path_list.end(); ++j){
-            SequencePath que_path = *j;
-            if(que_path.removable) continue;
-            if(!que_path.same_donor_len) continue;
-            //dout << "Comparing following paths: " << endl;
-            //PrintPath(ref_path);
-            //PrintPath(que_path);
-            if(DonorLengthEqual(ref_path, que_path)){
-                if(ref_path.score >= que_path.score){
-                    (*j).removable = true;
-                    //dout << "delete path: " << endl;
-                    //PrintPath((*j));
-                }else{
-                    (*i).removable = true;
-                    //dout << "delete path: " << endl;
-                    //PrintPath((*i));
-                    break;
-                }
-            }
-            //dout << "-    -     -   -   -   -   -  - - -" << endl;
+    unordered_map<ConvergeKey, list<SequencePath>::iterator, ConvergeKeyHash> best_path_by_key;
+    best_path_by_key.reserve(path_num);
+    for(list<SequencePath>::iterator i = path_list.begin(); i != path_list.end(); ++i){
+        if(!i->same_donor_len) continue;
+        ConvergeKey key = GetConvergeKey(*i);
+        auto best_it = best_path_by_key.find(key);
+        if(best_it == best_path_by_key.end()){
+            best_path_by_key[key] = i;
+        }else if(i->score > best_it->second->score){
+            best_it->second->removable = true;
+            best_it->second = i;
+        }else{
+            i->removable = true;
         }
     }
 
@@ -2836,13 +3424,8 @@ int WholeGenome::test() {
 }
 
 // private
-void WholeGenome::ClusteringMatchMultiThread() {
-	int start = 0;
-	int cluster_number = variants_by_cluster.size(); // cluster number
-	int cluster_end_boundary = start + cluster_number; // end cluster id, exclusive
-	int cluster_step = cluster_number / thread_num; // assign clusters to threads
-	if (cluster_step * thread_num < cluster_number) cluster_step++;
-	int end = start + cluster_step;
+// per-thread matching results, filled by matching threads and merged when written
+void WholeGenome::AllocateMatchResults(){
 	//initialize vector size
 	//complex_match_records = new vector<string>*[thread_num];
 	match_records_by_mode_by_thread = new vector<string>**[thread_num];
@@ -2870,53 +3453,161 @@ void WholeGenome::ClusteringMatchMultiThread() {
         baseline_total_edit_distance[i] = new vector<int> * [ROC_SAMPLE_NUM];
         query_total_edit_distance[i] = new vector<int>* [ROC_SAMPLE_NUM];
 
-        for(int j = 0; j < ROC_SAMPLE_NUM; j++){
-            baseline_total_match_num[i][j] = new vector<int>;
-            baseline_total_match_num[i][j]->resize(MATCH_MODE_NUM, 0);
-            query_total_match_num[i][j] = new vector<int>;
-            query_total_match_num[i][j]->resize(MATCH_MODE_NUM, 0);
+        for(int j = 0; j < ROC_SAMPLE_NUM; j++){
+            baseline_total_match_num[i][j] = new vector<int>;
+            baseline_total_match_num[i][j]->resize(MATCH_MODE_NUM, 0);
+            query_total_match_num[i][j] = new vector<int>;
+            query_total_match_num[i][j]->resize(MATCH_MODE_NUM, 0);
+
+            baseline_total_edit_distance[i][j] = new vector<int>;
+            baseline_total_edit_distance[i][j]->resize(MATCH_MODE_NUM, 0);
+            query_total_edit_distance[i][j] = new vector<int>;
+            query_total_edit_distance[i][j]->resize(MATCH_MODE_NUM, 0);
+        }
+    }
+
+    current_cluster_stat_by_thread = new ClusterStat[thread_num];
+    cluster_stats_by_thread = new vector<ClusterStat>*[thread_num];
+    budget_exceeded_clusters_by_thread = new vector<ClusterStat>*[thread_num];
+    deferred_clusters_by_thread = new vector<DeferredCluster>*[thread_num];
+    for(int i = 0; i < thread_num; i++){
+        cluster_stats_by_thread[i] = new vector<ClusterStat>;
+        budget_exceeded_clusters_by_thread[i] = new vector<ClusterStat>;
+        deferred_clusters_by_thread[i] = new vector<DeferredCluster>;
+    }
+}
+
+// pairs matched before clustering count as matches of every mode, like single pair clusters
+void WholeGenome::AddExactMatchResults(){
+    // all pairs go to the first shard, which holds the first records of a single run as well
+    if(!exact_prepass || shard_index > 0) return;
+    int exact_match_num = 0;
+    for(int i = 0; i < chrom_num; i++){
+        exact_match_num += exact_match_num_by_chrid[i][0];
+        for(int mi = 0; mi < mode_index_list.size(); mi++){
+            int mode_i = mode_index_list[mi];
+            vector<string> & match_records = *match_records_by_mode_by_thread[0][mode_i];
+            match_records.insert(match_records.end(), exact_match_records_by_chrid[i].begin(), exact_match_records_by_chrid[i].end());
+            for(int t = 0; t < threshold_num; t++){
+                baseline_total_match_num[0][t]->at(mode_i) += exact_match_num_by_chrid[i][t];
+                query_total_match_num[0][t]->at(mode_i) += exact_match_num_by_chrid[i][t];
+                baseline_total_edit_distance[0][t]->at(mode_i) += exact_edit_distance_by_chrid[i][t];
+                query_total_edit_distance[0][t]->at(mode_i) += exact_edit_distance_by_chrid[i][t];
+            }
+        }
+    }
+    cout << "[VarMatch] " << exact_match_num << " identical variant pairs matched before clustering" << endl;
+    exact_match_records_by_chrid.clear();
+    exact_match_num_by_chrid.clear();
+    exact_edit_distance_by_chrid.clear();
+}
+
+void WholeGenome::ReleaseMatchResults(){
+    // clear all matching records
+	for(int i = 0; i < thread_num; i++){
+        delete cluster_stats_by_thread[i];
+        delete budget_exceeded_clusters_by_thread[i];
+        delete deferred_clusters_by_thread[i];
+        for(int j = 0; j < MATCH_MODE_NUM; j++){
+            delete match_records_by_mode_by_thread[i][j];
+
+        }
+        for(int j = 0; j < ROC_SAMPLE_NUM; j++){
+            delete baseline_total_match_num[i][j];
+            delete query_total_match_num[i][j];
+
+            delete baseline_total_edit_distance[i][j];
+            delete query_total_edit_distance[i][j];
+        }
+        delete[] match_records_by_mode_by_thread[i];
+        delete[] baseline_total_match_num[i];
+        delete[] query_total_match_num[i];
+        
+        delete[] baseline_total_edit_distance[i];
+        delete[] query_total_edit_distance[i];
+	}
+	delete[] match_records_by_mode_by_thread;
+    delete[] cluster_stats_by_thread;
+    delete[] budget_exceeded_clusters_by_thread;
+    delete[] deferred_clusters_by_thread;
+    delete[] current_cluster_stat_by_thread;
+    delete[] baseline_total_match_num;
+    delete[] query_total_match_num;
+
+    delete[] baseline_total_edit_distance;
+    delete[] query_total_edit_distance;
+}
 
-            baseline_total_edit_distance[i][j] = new vector<int>;
-            baseline_total_edit_distance[i][j]->resize(MATCH_MODE_NUM, 0);
-            query_total_edit_distance[i][j] = new vector<int>;
-            query_total_edit_distance[i][j]->resize(MATCH_MODE_NUM, 0);
+// clusters of this shard, contiguous and balanced by variant number. clusters are in genome order,
+// so outputs of shards concatenated in shard order are in the order of a single run
+void WholeGenome::ShardClusterRange(int & start, int & end){
+    long long total_variant_num = 0;
+    for(int c = 0; c < variants_by_cluster.size(); c++){
+        total_variant_num += variants_by_cluster[c].size();
+    }
+    long long shard_begin = total_variant_num * shard_index / shard_num;
+    long long shard_end = total_variant_num * (shard_index + 1) / shard_num;
+    long long variant_num = 0;
+    start = -1;
+    end = variants_by_cluster.size();
+    for(int c = 0; c < variants_by_cluster.size(); c++){
+        if(start < 0 && variant_num >= shard_begin) start = c;
+        if(variant_num >= shard_end){
+            end = c;
+            break;
         }
+        variant_num += variants_by_cluster[c].size();
     }
+    if(start < 0) start = end;
+}
 
-	vector<thread> threads;
-	//spawn threads
-	unsigned i = 0;
-	for (; i < thread_num - 1; i++) {
-		threads.push_back(thread(&WholeGenome::ClusteringMatchInThread, this, start, end, i));
-		start = end;
-		end = start + cluster_step;
-	}
-	// also you need to do a job in main thread
-	// i equals to (thread_num - 1)
-	if (i != thread_num - 1) {
-		dout << "[Error] thread number not match" << endl;
-	}
-	if (start >= variants_by_cluster.size()) {
-		dout << "[Error] index out of map range" << endl;
-	}
-	else {
-		ClusteringMatchInThread(start, end, i);
-	}
-
-	// call join() on each thread in turn before this function?
-    std::for_each(threads.begin(), threads.end(), std::mem_fn(&std::thread::join));
+void WholeGenome::ClusteringMatchMultiThread() {
+	int start = 0;
+	int cluster_number = variants_by_cluster.size(); // cluster number
+    if(shard_num > 1){
+        int shard_end = 0;
+        ShardClusterRange(start, shard_end);
+        cluster_number = shard_end - start;
+        cout << "[VarMatch] shard " << shard_index << "/" << shard_num << ": clusters " << start << " to " << shard_end << " of " << variants_by_cluster.size() << endl;
+    }
+	int cluster_end_boundary = start + cluster_number; // end cluster id, exclusive
+	int cluster_step = cluster_number / thread_num; // assign clusters to threads
+	if (cluster_step * thread_num < cluster_number) cluster_step++;
+    AllocateMatchResults();
+    AddExactMatchResults();
+
+	// thread i matches the i-th range of clusters with its own result buffers
+	int cluster_start = start;
+	ThreadPool::Shared().ParallelFor(thread_num, [&](int i){
+		int thread_start = min(cluster_start + i * cluster_step, cluster_end_boundary);
+		ClusteringMatchInThread(thread_start, min(thread_start + cluster_step, cluster_end_boundary), i);
+	});
+
+    // huge clusters left by every thread are matched one at a time, with paths expanded by all threads
+    expand_paths_in_parallel = true;
+    for(int i = 0; i < thread_num; i++){
+        for(int k = 0; k < deferred_clusters_by_thread[i]->size(); k++){
+            MatchDeferredCluster(deferred_clusters_by_thread[i]->at(k), i);
+        }
+    }
+    expand_paths_in_parallel = false;
 
     //output all results
     cout << "writing results..." << endl;
     ofstream output_stat_file;
-    output_stat_file.open(output_dir + "/" + output_prefix+".stat");
+    if(write_result_files) output_stat_file.open(output_dir + "/" + output_prefix+".stat");
 
     cout << "=========VarMatch Result Stat.=======" << endl;
     string stat_head_string = "#score_unit\tmatch_mode\tscore_unit\tqual_threshold\tbaseline_match_num\tquery_match_num\tquery_total_num\tbaseline_total_ED\tquery_total_ED";
     cout << stat_head_string << endl;
-    output_stat_file << "##Baseline:" << baseline_variant_total_num << endl;
-    output_stat_file << "##Query:"<< query_variant_total_num << endl;
-    output_stat_file << stat_head_string << endl;
+    if(write_result_files){
+        output_stat_file << "##Baseline:" << baseline_variant_total_num << endl;
+        output_stat_file << "##Query:"<< query_variant_total_num << endl;
+        if(shard_num > 1){
+            output_stat_file << "##Shard:" << shard_index << "/" << shard_num << endl;
+        }
+        output_stat_file << stat_head_string << endl;
+    }
 
     int score_unit;
     int match_mode;
@@ -2940,6 +3631,8 @@ void WholeGenome::ClusteringMatchMultiThread() {
                 string baseline_edit_distance_string = "";
                 string query_edit_distance_string = "";
 
+                VarMatchStat match_stat = NewMatchStat(score_unit, match_mode, score_scheme, query_variant_total_num);
+
                 for(int t = 0; t < threshold_num; t++){
                     
                     threshold_string += to_string(threshold_list[t]);
@@ -2965,6 +3658,13 @@ void WholeGenome::ClusteringMatchMultiThread() {
                     baseline_edit_distance_string += to_string(baseline_edit_distance_by_threshold_by_mode);
                     query_edit_distance_string += to_string(query_edit_distance_by_threshold_by_mode);
 
+                    match_stat.thresholds.push_back(threshold_list[t]);
+                    match_stat.baseline_match_num.push_back(baseline_match_num_by_threshold_by_mode);
+                    match_stat.query_match_num.push_back(query_match_num_by_threshold_by_mode);
+                    match_stat.query_total_num_by_threshold.push_back((int)(query_variant_total_num * (1-per_list[t])));
+                    match_stat.baseline_edit_distance.push_back(baseline_edit_distance_by_threshold_by_mode);
+                    match_stat.query_edit_distance.push_back(query_edit_distance_by_threshold_by_mode);
+
                     if(t < threshold_num-1){
                         threshold_string += ",";
                         baseline_match_num_string += ",";
@@ -2984,11 +3684,12 @@ void WholeGenome::ClusteringMatchMultiThread() {
                                                 query_match_num_string + "\t" + 
                                                 query_total_num_string;// + "\t" + to_string(mode_index);
                 cout << total_match_num_string << "\t" << baseline_edit_distance_string << "\t" << query_edit_distance_string << endl;;
-                output_stat_file << total_match_num_string << endl;
+                if(write_result_files) output_stat_file << total_match_num_string << endl;
+                if(match_stat_callback) match_stat_callback(match_stat);
             }
         }
     }
-    output_stat_file.close();
+    if(write_result_files) output_stat_file.close();
 
     int bench_mode_index = GetIndexFromMatchScore(0, 0, 0);
 
@@ -3002,11 +3703,13 @@ void WholeGenome::ClusteringMatchMultiThread() {
                 string filename_index = to_string(score_unit) + "_" + to_string(match_mode) + "_" + to_string(score_scheme);
                 
                 ofstream output_complex_file;
-                output_complex_file.open(output_dir + "/" + output_prefix+"."+filename_index+".match");
+                if(write_result_files){
+                    output_complex_file.open(output_dir + "/" + output_prefix+"."+filename_index+".match");
 
-                output_complex_file << "##VCF1:" << ref_vcf_filename << endl;
-                output_complex_file << "##VCF2:" << que_vcf_filename << endl;
-                output_complex_file << "#CHROM\tPOS\tREF\tALT\tVCF1\tVCF2\tPHASE1\tPHASE2\tSCORE" << endl;
+                    output_complex_file << "##VCF1:" << ref_vcf_filename << endl;
+                    output_complex_file << "##VCF2:" << que_vcf_filename << endl;
+                    output_complex_file << "#CHROM\tPOS\tREF\tALT\tVCF1\tVCF2\tPHASE1\tPHASE2\tSCORE" << endl;
+                }
 
                 for(int i = 0; i < thread_num; i++){
                     for(int k = 0; k < match_records_by_mode_by_thread[i][mode_index]->size(); k++){
@@ -3015,43 +3718,133 @@ void WholeGenome::ClusteringMatchMultiThread() {
                                 //int bench_mode_index = stoi(match_records_by_mode_by_thread[i][mode_index]->at(k).erase(0,1));
                                 //output_complex_file << match_records_by_mode_by_thread[i][0]->at(k);
                             //}else{
-                                output_complex_file << match_records_by_mode_by_thread[i][mode_index]->at(k);
+                                if(write_result_files) output_complex_file << match_records_by_mode_by_thread[i][mode_index]->at(k);
+                                ReportMatchRecords(score_unit, match_mode, score_scheme, match_records_by_mode_by_thread[i][mode_index]->at(k));
                             //}
                         }
                     }
                 }
-                output_complex_file.close();
+                if(write_result_files) output_complex_file.close();
             }
         }
     }
 
-    // clear all matching records
-	for(int i = 0; i < thread_num; i++){
-        for(int j = 0; j < MATCH_MODE_NUM; j++){
-            delete match_records_by_mode_by_thread[i][j];
+    int budget_exceeded_cluster_num = 0;
+    for(int i = 0; i < thread_num; i++){
+        budget_exceeded_cluster_num += budget_exceeded_clusters_by_thread[i]->size();
+    }
+    if(budget_exceeded_cluster_num > 0){
+        cout << "[VarMatch] Warning: " << budget_exceeded_cluster_num << " clusters exceeded matching budget, "
+             << "only directly matched inside these clusters." << endl;
+    }
 
-        }
-        for(int j = 0; j < ROC_SAMPLE_NUM; j++){
-            delete baseline_total_match_num[i][j];
-            delete query_total_match_num[i][j];
+    if(cluster_report){
+        OutputClusterReport();
+    }
 
-            delete baseline_total_edit_distance[i][j];
-            delete query_total_edit_distance[i][j];
-        }
-        delete[] match_records_by_mode_by_thread[i];
-        delete[] baseline_total_match_num[i];
-        delete[] query_total_match_num[i];
-        
-        delete[] baseline_total_edit_distance[i];
-        delete[] query_total_edit_distance[i];
-	}
-	delete[] match_records_by_mode_by_thread;
-    delete[] baseline_total_match_num;
-    delete[] query_total_match_num;
+    ReleaseMatchResults();
+}
 
-    delete[] baseline_total_edit_distance;
-    delete[] query_total_edit_distance;
+bool CompareClusterTime(const ClusterStat & a, const ClusterStat & b){ return a.seconds > b.seconds; }
+
+string JsonString(const string & s){
+    string result = "\"";
+    for(int i = 0; i < s.size(); i++){
+        if(s[i] == '"' || s[i] == '\\') result += '\\';
+        result += s[i];
+    }
+    return result + "\"";
+}
+
+// write cluster size distribution and matching cost of clusters in JSON,
+// so that pathological regions can be located without a profiler
+void WholeGenome::OutputClusterReport(){
+    vector<ClusterStat> cluster_stats;
+    for(int i = 0; i < thread_num; i++){
+        cluster_stats.insert(cluster_stats.end(), cluster_stats_by_thread[i]->begin(), cluster_stats_by_thread[i]->end());
+    }
+
+    long long total_path_num = 0;
+    int max_path_list_size = 0;
+    double total_seconds = 0.0;
+    // path number histogram, bucket k contains clusters with [2^k, 2^(k+1)) paths,
+    // bucket -1 contains clusters matched without path extension
+    map<int, int> path_num_histogram;
+    for(int i = 0; i < cluster_stats.size(); i++){
+        ClusterStat & cs = cluster_stats[i];
+        total_path_num += cs.path_num;
+        max_path_list_size = max(max_path_list_size, cs.max_path_list_size);
+        total_seconds += cs.seconds;
+        int bucket = -1;
+        if(cs.path_num > 0) bucket = 0;
+        while(bucket >= 0 && (2LL << bucket) <= cs.path_num) bucket++;
+        path_num_histogram[bucket]++;
+    }
+
+    int top_num = max(0, min(report_top_num, (int)cluster_stats.size()));
+    partial_sort(cluster_stats.begin(), cluster_stats.begin() + top_num, cluster_stats.end(), CompareClusterTime);
+
+    ofstream report_file;
+    report_file.open(output_dir + "/" + output_prefix + ".cluster.json");
+    report_file << "{" << endl;
+    report_file << "  \"baseline\": " << JsonString(ref_vcf_filename) << "," << endl;
+    report_file << "  \"query\": " << JsonString(que_vcf_filename) << "," << endl;
+    report_file << "  \"cluster_num\": " << variants_by_cluster.size() << "," << endl;
+    report_file << "  \"matched_cluster_num\": " << cluster_stats.size() << "," << endl;
+    if(split_clusters){
+        report_file << "  \"split_cluster_num\": " << split_cluster_num << "," << endl;
+        report_file << "  \"largest_cluster_before_split\": " << largest_cluster_before_split << "," << endl;
+    }
+    report_file << "  \"total_path_num\": " << total_path_num << "," << endl;
+    report_file << "  \"max_path_list_size\": " << max_path_list_size << "," << endl;
+    report_file << "  \"total_seconds\": " << total_seconds << "," << endl;
+
+    report_file << "  \"cluster_size_distribution\": [";
+    for(auto it = cluster_size_num.begin(); it != cluster_size_num.end(); ++it){
+        if(it != cluster_size_num.begin()) report_file << ",";
+        report_file << endl << "    {\"size\": " << it->first << ", \"count\": " << it->second;
+        report_file << ", \"first_chrom\": " << JsonString(chrname_by_chrid[cluster_size_chrid[it->first]]) << "}";
+    }
+    report_file << endl << "  ]," << endl;
+
+    report_file << "  \"path_num_distribution\": [";
+    for(auto it = path_num_histogram.begin(); it != path_num_histogram.end(); ++it){
+        if(it != path_num_histogram.begin()) report_file << ",";
+        report_file << endl << "    {\"min_path_num\": " << (it->first < 0 ? 0 : 1LL << it->first) << ", \"count\": " << it->second << "}";
+    }
+    report_file << endl << "  ]," << endl;
 
+    report_file << "  \"budget_exceeded_clusters\": [";
+    bool first_record = true;
+    for(int i = 0; i < thread_num; i++){
+        for(int j = 0; j < budget_exceeded_clusters_by_thread[i]->size(); j++){
+            ClusterStat & cs = budget_exceeded_clusters_by_thread[i]->at(j);
+            if(!first_record) report_file << ",";
+            first_record = false;
+            report_file << endl << "    {\"cluster_id\": " << cs.cluster_id;
+            report_file << ", \"chrom\": " << JsonString(chrname_by_chrid[cs.chr_id]);
+            report_file << ", \"start\": " << cs.start + 1 << ", \"end\": " << cs.end;
+            report_file << ", \"variant_num\": " << cs.variant_num << "}";
+        }
+    }
+    report_file << endl << "  ]," << endl;
+
+    report_file << "  \"slowest_clusters\": [";
+    for(int i = 0; i < top_num; i++){
+        ClusterStat & cs = cluster_stats[i];
+        if(i > 0) report_file << ",";
+        report_file << endl << "    {\"cluster_id\": " << cs.cluster_id;
+        report_file << ", \"chrom\": " << JsonString(chrname_by_chrid[cs.chr_id]);
+        report_file << ", \"start\": " << cs.start + 1 << ", \"end\": " << cs.end;
+        report_file << ", \"variant_num\": " << cs.variant_num;
+        report_file << ", \"path_num\": " << cs.path_num;
+        report_file << ", \"max_path_list_size\": " << cs.max_path_list_size;
+        report_file << ", \"seconds\": " << cs.seconds;
+        report_file << ", \"budget_exceeded\": " << (cs.budget_exceeded ? "true" : "false") << "}";
+    }
+    report_file << endl << "  ]" << endl;
+    report_file << "}" << endl;
+    report_file.close();
 }
 
 //[TODO] unit test
@@ -3104,8 +3897,16 @@ void WholeGenome::SingleThreadClustering(int chr_id) {
     sort(que_variant_by_chrid[chr_id]->begin(), que_variant_by_chrid[chr_id]->end());
     int ref_size = ref_variant_by_chrid[chr_id]->size();
     int que_size = que_variant_by_chrid[chr_id]->size();
+    const string & genome_sequence = GenomeSequence(chr_id);
     //dout << chr_id << "," << ref_size << "," << que_size << endl;
 
+    // identical baseline and query variants are matched before clustering and left out of clusters
+    vector<bool> ref_exact_matched(ref_size, false);
+    vector<bool> que_exact_matched(que_size, false);
+    if(exact_prepass){
+        ExactMatchPrepass(chr_id, ref_exact_matched, que_exact_matched);
+    }
+
     int ref_index = 0;
     int que_index = 0;
     bool not_first = false;
@@ -3133,12 +3934,13 @@ void WholeGenome::SingleThreadClustering(int chr_id) {
             var_index = ref_index;
             ref_index++;
 		}
+        if(take_que ? que_exact_matched[var_index] : ref_exact_matched[var_index]) continue;
 		// check if need to separator clusters
 		if (not_first) {
 			c_end = snp.pos;
 			if (c_end - c_start >= 2) {
                 int separator_length = c_end - c_start;
-				string separator = genome_sequences[chr_id].substr(c_start, separator_length);
+				string separator = genome_sequence.substr(c_start, separator_length);
 				int max_change = max(ins_len[0] + del_len[1], ins_len[1] + del_len[0]);
 				bool separate_cluster = false;
 				if(max_change == 0){
@@ -3177,6 +3979,155 @@ void WholeGenome::SingleThreadClustering(int chr_id) {
     if(vi_list.size() > 0){
         variant_cluster_by_chrid[chr_id]->push_back(vi_list);
     }
+    if(split_clusters){
+        SplitClustersAtSyncGaps(chr_id);
+    }
+}
+
+// sorted variants of both sides are walked together, identical variants at the same position are
+// paired one to one. only variants passing the same thresholds are paired, so that at every threshold
+// a pair is either matched or filtered out as a whole, the others are left to clustering.
+// like a single pair cluster, a pair has a record for each threshold it passes
+void WholeGenome::ExactMatchPrepass(int chr_id, vector<bool> & ref_exact_matched, vector<bool> & que_exact_matched){
+    vector<DiploidVariant> & ref_variants = *ref_variant_by_chrid[chr_id];
+    vector<DiploidVariant> & que_variants = *que_variant_by_chrid[chr_id];
+    int r = 0;
+    int q = 0;
+    while(r < ref_variants.size() && q < que_variants.size()){
+        int ref_pos = ref_variants[r].pos;
+        int que_pos = que_variants[q].pos;
+        if(ref_pos < que_pos){
+            r++;
+            continue;
+        }
+        if(que_pos < ref_pos){
+            q++;
+            continue;
+        }
+        int r_end = r;
+        int q_end = q;
+        while(r_end < ref_variants.size() && ref_variants[r_end].pos == ref_pos) r_end++;
+        while(q_end < que_variants.size() && que_variants[q_end].pos == que_pos) q_end++;
+        for(int j = q; j < q_end; j++){
+            for(int i = r; i < r_end; i++){
+                if(ref_exact_matched[i] || !(que_variants[j] == ref_variants[i])) continue;
+                if(!PassSameThresholds(ref_variants[i].qual, que_variants[j].qual)) continue;
+                ref_exact_matched[i] = true;
+                que_exact_matched[j] = true;
+                DiploidVariant & tv = ref_variants[i];
+                string match_record = chrname_by_chrid[chr_id] + "\t" + to_string(tv.pos+1) + "\t" + tv.ref + "\t" + tv.alts[0];
+                if(tv.multi_alts) match_record += "/" + tv.alts[1];
+                match_record += "\t.\t.\t.\t.\t.\n";
+                int edit_distance = CalculateEditDistance(tv, 0, 0);
+                for(int t = 0; t < threshold_num; t++){
+                    if(tv.qual < threshold_list[t]) continue;
+                    exact_match_records_by_chrid[chr_id].push_back(match_record);
+                    exact_match_num_by_chrid[chr_id][t]++;
+                    exact_edit_distance_by_chrid[chr_id][t] += edit_distance;
+                }
+                break;
+            }
+        }
+        r = r_end;
+        q = q_end;
+    }
+}
+
+bool WholeGenome::PassSameThresholds(double qual, double other_qual){
+    for(int t = 0; t < threshold_num; t++){
+        if((qual < threshold_list[t]) != (other_qual < threshold_list[t])) return false;
+    }
+    return true;
+}
+
+// the unchanged gap sequence[start, start+length) equals itself shifted by d for some 1 <= d <= max_period
+bool WholeGenome::GapHasPeriod(const string & sequence, int start, int length, int max_period){
+    for(int d = 1; d <= max_period && d < length; d++){
+        bool periodic = true;
+        for(int i = start; i + d < start + length; i++){
+            if(toupper(sequence[i]) != toupper(sequence[i+d])){
+                periodic = false;
+                break;
+            }
+        }
+        if(periodic) return true;
+    }
+    return false;
+}
+
+// every matching of a cluster is in sync at a gap between its variants if the gap forbids any length offset:
+// an offset d at the gap is created by variants on its left and removed by variants on its right,
+// so 1 <= d <= D = min(left max change, right max change), and donors can only stay equal over the
+// unchanged gap if the gap is d-periodic. clusters are split at gaps longer than D without such a period,
+// the parts are matched independently and their scores add up to the score of the whole cluster
+void WholeGenome::SplitClustersAtSyncGaps(int chr_id){
+    vector<vector<VariantIndicator>> split_cluster_list;
+    const string & genome_sequence = GenomeSequence(chr_id);
+    for(int c = 0; c < variant_cluster_by_chrid[chr_id]->size(); c++){
+        vector<VariantIndicator> & vi_list = variant_cluster_by_chrid[chr_id]->at(c);
+        int var_num = vi_list.size();
+        largest_cluster_before_split_by_chrid[chr_id] = max(largest_cluster_before_split_by_chrid[chr_id], var_num);
+
+        vector<DiploidVariant *> var_list;
+        for(int k = 0; k < var_num; k++){
+            VariantIndicator & vi = vi_list[k];
+            var_list.push_back(vi.refer ? &ref_variant_by_chrid[chr_id]->at(vi.var_id) : &que_variant_by_chrid[chr_id]->at(vi.var_id));
+        }
+        // length change of variants at and after k, baseline and query
+        vector<int> suffix_ins[2];
+        vector<int> suffix_del[2];
+        for(int i = 0; i < 2; i++){
+            suffix_ins[i].resize(var_num + 1, 0);
+            suffix_del[i].resize(var_num + 1, 0);
+        }
+        for(int k = var_num - 1; k >= 0; k--){
+            int flag = 0;
+            if(var_list[k]->flag) flag = 1;
+            for(int i = 0; i < 2; i++){
+                suffix_ins[i][k] = suffix_ins[i][k+1];
+                suffix_del[i][k] = suffix_del[i][k+1];
+            }
+            suffix_ins[flag][k] += var_list[k]->mil;
+            suffix_del[flag][k] += var_list[k]->mdl;
+        }
+
+        int ins_len[2] = { 0 };
+        int del_len[2] = { 0 };
+        int covered_end = 0;
+        int part_num = 0;
+        vector<VariantIndicator> part;
+        for(int k = 0; k < var_num; k++){
+            DiploidVariant & var = *var_list[k];
+            int gap_length = var.pos - covered_end;
+            if(k > 0 && gap_length > 0){
+                int left_change = max(ins_len[0] + del_len[1], ins_len[1] + del_len[0]);
+                int right_change = max(suffix_ins[0][k] + suffix_del[1][k], suffix_ins[1][k] + suffix_del[0][k]);
+                int max_offset = min(left_change, right_change);
+                if(max_offset == 0 ||
+                   (gap_length > max_offset && !GapHasPeriod(genome_sequence, covered_end, gap_length, max_offset))){
+                    split_cluster_list.push_back(part);
+                    part.clear();
+                    part_num++;
+                    for(int i = 0; i < 2; i++){
+                        ins_len[i] = 0;
+                        del_len[i] = 0;
+                    }
+                }
+            }
+            part.push_back(vi_list[k]);
+            covered_end = max(covered_end, var.pos + (int)var.ref.length());
+            int flag = 0;
+            if(var.flag) flag = 1;
+            ins_len[flag] += var.mil;
+            del_len[flag] += var.mdl;
+        }
+        split_cluster_list.push_back(part);
+        part_num++;
+        if(part_num > 1){
+            split_cluster_num_by_chrid[chr_id]++;
+        }
+    }
+    variant_cluster_by_chrid[chr_id]->swap(split_cluster_list);
 }
 
 int WholeGenome::ReadReferenceVariants(string filename){
@@ -3187,30 +4138,165 @@ int WholeGenome::ReadQueryVariants(string filename){
     return ReadWholeGenomeVariant(filename, true);
 }
 
-void WholeGenome::ReadRef(string genome_seq, string ref_vcf){
+bool WholeGenome::ReadRef(string genome_seq, string ref_vcf){
 
-    ReadWholeGenomeSequence(genome_seq);
+    if(target_regions.size() == 0 || !ReadGenomeRegions(genome_seq)){
+        if(!ReadWholeGenomeSequence(genome_seq)) return false;
+    }
+    if(numa_replicas) ReplicateGenome();
     baseline_variant_total_num = ReadReferenceVariants(ref_vcf);
     ref_vcf_filename = ref_vcf;
+    return baseline_variant_total_num >= 0;
+
+}
+
+// chromosome names come from the FASTA index when there is one, otherwise from FASTA headers,
+// sequences are not kept as direct matching does not need them
+bool WholeGenome::ReadChromosomeNames(string filename){
+    vector<string> chr_names;
+    ifstream fai_file((filename + ".fai").c_str());
+    if(fai_file.good()){
+        string line;
+        while(getline(fai_file, line).good()){
+            if(line.empty()) continue;
+            chr_names.push_back(split(line, '\t')[0]);
+        }
+    }else{
+        ifstream fasta_file(filename.c_str());
+        if(!fasta_file.good()){
+            cout << "[VarMatch] Error: can not open genome sequence file " << filename << endl;
+            return false;
+        }
+        string line;
+        while(getline(fasta_file, line).good()){
+            if(line.empty() || line[0] != '>') continue;
+            chr_names.push_back(split(line, ' ')[0].substr(1));
+        }
+    }
+
+    for(int j = 0; j < chrom_num; j++){
+        delete ref_variant_by_chrid[j];
+        delete que_variant_by_chrid[j];
+    }
+    delete[] ref_variant_by_chrid;
+    delete[] que_variant_by_chrid;
+
+    chrid_by_chrname.clear();
+    chrname_by_chrid.clear();
+    chrom_num = 0;
+    for(int i = 0; i < chr_names.size(); i++){
+        if(chrid_by_chrname.find(chr_names[i]) != chrid_by_chrname.end()) continue;
+        chrid_by_chrname[chr_names[i]] = chrom_num;
+        chrname_by_chrid[chrom_num] = chr_names[i];
+        chrom_num++;
+    }
 
+    ref_variant_by_chrid = new vector<DiploidVariant>*[chrom_num];
+    que_variant_by_chrid = new vector<DiploidVariant>*[chrom_num];
+    for(int j = 0; j < chrom_num; j++){
+        ref_variant_by_chrid[j] = new vector<DiploidVariant>;
+        que_variant_by_chrid[j] = new vector<DiploidVariant>;
+    }
+    return chrom_num > 0;
 }
 
-void WholeGenome::ReadDirectRef(string genome_seq, string ref_vcf){
+bool WholeGenome::ReadDirectRef(string genome_seq, string ref_vcf){
 
-    for(int i = 0; i < 22; i++){
-        chrid_by_chrname[to_string(i+1)] = i;
-        chrname_by_chrid[i] = to_string(i+1);
+    direct_match = true;
+    if(!ReadChromosomeNames(genome_seq)){
+        cout << "[VarMatch] Error: no chromosome found in " << genome_seq << endl;
+        return false;
     }
-    chrid_by_chrname["X"] = 22;
-    chrname_by_chrid[22] = "X";
-    chrid_by_chrname["Y"] = 23;
-    chrname_by_chrid[23]="Y";
     baseline_variant_total_num = ReadReferenceVariants(ref_vcf);
     ref_vcf_filename = ref_vcf;
+    // sorted once here, every query walks baseline variants in order
+    for(int i = 0; i < chrom_num; i++){
+        stable_sort(ref_variant_by_chrid[i]->begin(), ref_variant_by_chrid[i]->end(),
+            [](const DiploidVariant & a, const DiploidVariant & b){ return a.pos < b.pos; });
+    }
+    return baseline_variant_total_num >= 0;
+
+}
+
+void WholeGenome::SetResultCallbacks(MatchRecordCallback record_callback,
+                                     MatchStatCallback stat_callback,
+                                     bool write_result_files_){
+    match_record_callback = record_callback;
+    match_stat_callback = stat_callback;
+    write_result_files = write_result_files_;
+}
+
+void WholeGenome::SetQueryLines(const vector<string> * lines){
+    query_lines = lines;
+}
+
+// the calling thread reads the genome on node 0, every other node gets a copy made by one of its cpus.
+// matching threads are pinned across nodes and read the copy of their own node
+void WholeGenome::SetNumaReplicas(bool numa_replicas_){
+    numa_replicas = numa_replicas_;
+    if(!numa_replicas) return;
+    ThreadPool::Shared().SetPinning(true);
+    ThreadPool::Shared().PinCurrentThreadToNode(0);
+}
+
+void WholeGenome::ReplicateGenome(){
+    ThreadPool & thread_pool = ThreadPool::Shared();
+    for(int i = 0; i < genome_replicas.size(); i++){
+        delete genome_replicas[i];
+    }
+    genome_replicas.clear();
+    for(int node = 1; node < thread_pool.NodeNum(); node++){
+        map<int, string> * genome_replica = NULL;
+        thread_pool.RunOnNode(node, [&](){
+            genome_replica = new map<int, string>(genome_sequences);
+        });
+        genome_replicas.push_back(genome_replica);
+    }
+    if(genome_replicas.size() > 0){
+        cout << "[VarMatch] genome copied to " << genome_replicas.size() << " more NUMA nodes" << endl;
+    }
+}
+
+const string & WholeGenome::GenomeSequence(int chr_id){
+    if(genome_replicas.size() > 0){
+        int node = ThreadPool::Shared().CurrentNode();
+        if(node > 0 && node <= genome_replicas.size()){
+            map<int, string>::iterator it = genome_replicas[node-1]->find(chr_id);
+            if(it != genome_replicas[node-1]->end()) return it->second;
+        }
+    }
+    return genome_sequences[chr_id];
+}
 
+void WholeGenome::SetOutputDir(string output_dir_){
+    output_dir = output_dir_;
+}
+
+VarMatchStat WholeGenome::NewMatchStat(int score_unit, int match_mode, int score_scheme, int query_total_num){
+    VarMatchStat match_stat;
+    match_stat.score_unit = score_unit;
+    match_stat.match_mode = match_mode;
+    match_stat.score_scheme = score_scheme;
+    match_stat.baseline_total_num = baseline_variant_total_num;
+    match_stat.query_total_num = query_total_num;
+    return match_stat;
+}
+
+// records are lines ending with a line break, as written to .match files
+void WholeGenome::ReportMatchRecords(int score_unit, int match_mode, int score_scheme, const string & match_records){
+    if(!match_record_callback) return;
+    size_t start = 0;
+    while(start < match_records.size()){
+        size_t end = match_records.find('\n', start);
+        if(end == string::npos) end = match_records.size();
+        if(end > start){
+            match_record_callback(score_unit, match_mode, score_scheme, match_records.substr(start, end - start));
+        }
+        start = end + 1;
+    }
 }
 
-void WholeGenome::Compare(string query_vcf,
+bool WholeGenome::Compare(string query_vcf,
 	string output_prefix,
     bool detail_results,
     int score_unit_,
@@ -3230,11 +4316,14 @@ void WholeGenome::Compare(string query_vcf,
     score_scheme_indicator = score_scheme_;
 
     if(score_scheme_indicator == 3){
-        DirectMatch(ref_vcf_filename, query_vcf, match_mode_, output_prefix);
-        return;
+        return DirectMatch(vector<string>(1, query_vcf), vector<string>(1, output_prefix), score_unit_, match_mode_);
     }
 
     query_variant_total_num = ReadQueryVariants(query_vcf);
+    if(query_variant_total_num < 0){
+        query_variant_total_num = 0;
+        return false;
+    }
 
     if(score_unit_indicator == -1){
         score_unit_list.push_back(0);
@@ -3303,54 +4392,292 @@ void WholeGenome::Compare(string query_vcf,
     score_scheme_list.clear();
     mode_index_list.clear();
 
-    return;
+    return true;
 }
 
-void WholeGenome::DirectMatch(string ref_vcf, string query_vcf, int match_mode_, string output_prefix)
-{
-    //dout << "direct match" << endl;
-    match_mode_indicator = match_mode_;
-    //int ref_variant_num = ReadReferenceVariants(ref_vcf);
-    int que_variant_num = ReadQueryVariants(query_vcf);
-    //dout << que_variant_num << endl;
-    int match_num = 0;
-    ofstream output_stat_file;
-    output_stat_file.open(output_dir + "/" + output_prefix+".direct");
-    for(int i = 0; i < chrom_num; i++){
-        if(ref_variant_by_chrid[i]->size() == 0 || que_variant_by_chrid[i]->size() == 0)
+// positions of one chromosome are walked in order on both sides, variants at the same position
+// are paired one to one, separately for every match mode and quality threshold.
+// baseline variants are sorted once in ReadDirectRef
+void WholeGenome::DirectMatchChromosome(DirectQuery & query, int chr_id){
+    vector<DiploidVariant> & ref_variants = *ref_variant_by_chrid[chr_id];
+    vector<DiploidVariant> & que_variants = *query.variant_by_chrid[chr_id];
+    if(ref_variants.size() == 0 || que_variants.size() == 0) return;
+
+    // query variants are sorted by index so that VCF files out of order are still matched
+    vector<int> que_order(que_variants.size());
+    for(int i = 0; i < que_order.size(); i++) que_order[i] = i;
+    stable_sort(que_order.begin(), que_order.end(), [&](int a, int b){ return que_variants[a].pos < que_variants[b].pos; });
+
+    vector<bool> ref_used;
+    int r = 0;
+    int q = 0;
+    while(r < ref_variants.size() && q < que_order.size()){
+        int ref_pos = ref_variants[r].pos;
+        int que_pos = que_variants[que_order[q]].pos;
+        if(ref_pos < que_pos){
+            r++;
             continue;
-        //[TODO] not the right way to do it, at least need multimap
-        multimap<int, int> ref_variant_by_pos;
-        for(int j = 0; j < ref_variant_by_chrid[i]->size(); j++){
-            DiploidVariant var = ref_variant_by_chrid[i]->at(j);
-            int pos = var.pos;
-            ref_variant_by_pos.insert(pair<int, int>(pos, j));
-        }
-
-        for(int j = 0; j < que_variant_by_chrid[i]->size(); j++){
-            DiploidVariant var = que_variant_by_chrid[i]->at(j);
-            int pos = var.pos;
-            if(ref_variant_by_pos.find(pos) == ref_variant_by_pos.end())
-                continue;
+        }
+        if(que_pos < ref_pos){
+            q++;
+            continue;
+        }
+        int r_end = r;
+        int q_end = q;
+        while(r_end < ref_variants.size() && ref_variants[r_end].pos == ref_pos) r_end++;
+        while(q_end < que_order.size() && que_variants[que_order[q_end]].pos == que_pos) q_end++;
+
+        for(int m = 0; m < query.match_mode_list.size(); m++){
+            int match_mode = query.match_mode_list[m];
+            for(int t = 0; t < query.threshold_list.size(); t++){
+                double quality_threshold = query.threshold_list[t];
+                ref_used.assign(r_end - r, false);
+                for(int j = q; j < q_end; j++){
+                    DiploidVariant & que_var = que_variants[que_order[j]];
+                    if(que_var.qual < quality_threshold) continue;
+                    for(int i = r; i < r_end; i++){
+                        if(ref_used[i-r]) continue;
+                        DiploidVariant & ref_var = ref_variants[i];
+                        if(ref_var.qual < quality_threshold) continue;
+                        bool matched = false;
+                        if(match_mode == 0){
+                            matched = (que_var == ref_var);
+                        }else{
+                            matched = que_var.CompareNoGenotype(ref_var);
+                        }
+                        if(!matched) continue;
+                        ref_used[i-r] = true;
+                        query.match_num_by_chrid[chr_id][t]->at(match_mode)++;
+                        query.edit_distance_by_chrid[chr_id][t]->at(match_mode) += CalculateEditDistance(ref_var, 0, 0);
+                        if(t == 0){
+                            string & records = query.match_records_by_chrid[chr_id][match_mode];
+                            records += chrname_by_chrid[chr_id] + "\t" + to_string(ref_var.pos+1) + "\t" + ref_var.ref + "\t" + ref_var.alts[0];
+                            if(ref_var.multi_alts) records += "/" + ref_var.alts[1];
+                            records += "\t.\t.\t.\t.\t.\n";
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+        r = r_end;
+        q = q_end;
+    }
+}
+
+void WholeGenome::DirectMatchChromosomesInThread(DirectQuery * query, int thread_index, int query_thread_num){
+    // a shard matches a contiguous range of chromosomes, so shard outputs concatenate in chromosome order
+    int shard_chr_start = chrom_num * shard_index / shard_num;
+    int shard_chr_end = chrom_num * (shard_index + 1) / shard_num;
+    for(int chr_id = shard_chr_start + thread_index; chr_id < shard_chr_end; chr_id += query_thread_num){
+        DirectMatchChromosome(*query, chr_id);
+    }
+}
 
-            pair<multimap<int, int>::iterator, multimap<int, int>::iterator> var_range;
-            var_range = ref_variant_by_pos.equal_range(pos);
+// read, match and write one query, its memory is released before the next query of this thread is read,
+// returns false without writing results if the query can not be read
+bool WholeGenome::DirectMatchQuery(DirectQuery & query, int query_thread_num){
+    query.match_mode_list.clear();
+    query.threshold_list.clear();
+    query.per_list = per_list;
+    vector<DiploidVariant> ** variant_by_chrid = new vector<DiploidVariant>*[chrom_num];
+    for(int i = 0; i < chrom_num; i++){
+        variant_by_chrid[i] = new vector<DiploidVariant>;
+    }
+    query.variant_by_chrid = variant_by_chrid;
+    query.variant_total_num = ReadWholeGenomeVariant(query.vcf_filename,
+                                                     true,
+                                                     variant_by_chrid,
+                                                     query.match_mode_indicator,
+                                                     query.threshold_list,
+                                                     query.per_list,
+                                                     NULL);
+    if(query.variant_total_num < 0){
+        for(int i = 0; i < chrom_num; i++){
+            delete variant_by_chrid[i];
+        }
+        delete[] variant_by_chrid;
+        query.variant_by_chrid = NULL;
+        return false;
+    }
 
-            for(auto it = var_range.first; it != var_range.second; ++it){
-                int ref_index = (*it).second;
-                DiploidVariant ref_var = ref_variant_by_chrid[i]->at(ref_index);
-                if (match_mode_indicator != 1 && var == ref_var){
-                    match_num ++;
-                    string matched_variant = chrname_by_chrid[i] + "\t" + to_string(ref_var.pos) + "\t" + ref_var.ref + "\t";
-                    output_stat_file << matched_variant << endl;
-                    break;
-                }else if(match_mode_indicator == 1 && var.CompareNoGenotype(ref_var)){
-                    match_num ++;
-                    break;
+    // genotype matching may be turned off while reading query variants
+    if(query.match_mode_indicator == -1){
+        query.match_mode_list.push_back(0);
+        query.match_mode_list.push_back(1);
+    }else{
+        query.match_mode_list.push_back(query.match_mode_indicator);
+    }
+    int query_threshold_num = query.threshold_list.size();
+
+    query.match_records_by_chrid = new string*[chrom_num];
+    query.match_num_by_chrid = new vector<int>**[chrom_num];
+    query.edit_distance_by_chrid = new vector<int>**[chrom_num];
+    for(int i = 0; i < chrom_num; i++){
+        query.match_records_by_chrid[i] = new string[2];
+        query.match_num_by_chrid[i] = new vector<int>*[query_threshold_num];
+        query.edit_distance_by_chrid[i] = new vector<int>*[query_threshold_num];
+        for(int j = 0; j < query_threshold_num; j++){
+            query.match_num_by_chrid[i][j] = new vector<int>(2, 0);
+            query.edit_distance_by_chrid[i][j] = new vector<int>(2, 0);
+        }
+    }
+
+    ThreadPool::Shared().ParallelFor(query_thread_num, [&](int i){
+        DirectMatchChromosomesInThread(&query, i, query_thread_num);
+    });
+
+    // console output of concurrent queries is printed in one piece
+    string console_string = "Query VCF: " + query.vcf_filename + "\n";
+    console_string += "Baseline: " + to_string(baseline_variant_total_num) + "; Query: " + to_string(query.variant_total_num) + "\n";
+    string stat_head_string = "#score_unit\tmatch_mode\tscore_unit\tqual_threshold\tbaseline_match_num\tquery_match_num\tquery_total_num\tbaseline_total_ED\tquery_total_ED";
+    console_string += stat_head_string + "\n";
+
+    ofstream output_stat_file;
+    if(write_result_files){
+        output_stat_file.open(output_dir + "/" + query.output_prefix+".stat");
+        output_stat_file << "##Baseline:" << baseline_variant_total_num << endl;
+        output_stat_file << "##Query:"<< query.variant_total_num << endl;
+        if(shard_num > 1){
+            output_stat_file << "##Shard:" << shard_index << "/" << shard_num << endl;
+        }
+        output_stat_file << stat_head_string << endl;
+    }
+    // callbacks of concurrent queries are not called at the same time
+    output_mutex.lock();
+
+    // one pair is one baseline and one query variant, whatever the score unit
+    for(int x = 0; x < score_unit_list.size(); x++){
+        int score_unit = score_unit_list[x];
+        for(int y = 0; y < query.match_mode_list.size(); y++){
+            int match_mode = query.match_mode_list[y];
+            string threshold_string = "";
+            string match_num_string = "";
+            string query_total_num_string = "";
+            string edit_distance_string = "";
+            VarMatchStat match_stat = NewMatchStat(score_unit, match_mode, 3, query.variant_total_num);
+            for(int t = 0; t < query_threshold_num; t++){
+                int match_num = 0;
+                int edit_distance = 0;
+                for(int i = 0; i < chrom_num; i++){
+                    match_num += query.match_num_by_chrid[i][t]->at(match_mode);
+                    edit_distance += query.edit_distance_by_chrid[i][t]->at(match_mode);
+                }
+                threshold_string += to_string(query.threshold_list[t]);
+                match_num_string += to_string(match_num);
+                query_total_num_string += to_string((int)(query.variant_total_num * (1-query.per_list[t])) );
+                edit_distance_string += to_string(edit_distance);
+                match_stat.thresholds.push_back(query.threshold_list[t]);
+                match_stat.baseline_match_num.push_back(match_num);
+                match_stat.query_match_num.push_back(match_num);
+                match_stat.query_total_num_by_threshold.push_back((int)(query.variant_total_num * (1-query.per_list[t])));
+                match_stat.baseline_edit_distance.push_back(edit_distance);
+                match_stat.query_edit_distance.push_back(edit_distance);
+                if(t < query_threshold_num-1){
+                    threshold_string += ",";
+                    match_num_string += ",";
+                    query_total_num_string += ",";
+                    edit_distance_string += ",";
                 }
             }
+            string total_match_num_string = to_string(score_unit) + "\t" +
+                                            to_string(match_mode) + "\t" +
+                                            to_string(3) + "\t" +
+                                            threshold_string + "\t" +
+                                            match_num_string + "\t" +
+                                            match_num_string + "\t" +
+                                            query_total_num_string;
+            console_string += total_match_num_string + "\t" + edit_distance_string + "\t" + edit_distance_string + "\n";
+            if(match_stat_callback) match_stat_callback(match_stat);
+            for(int i = 0; i < chrom_num; i++){
+                ReportMatchRecords(score_unit, match_mode, 3, query.match_records_by_chrid[i][match_mode]);
+            }
+            if(!write_result_files) continue;
+            output_stat_file << total_match_num_string << endl;
+
+            string filename_index = to_string(score_unit) + "_" + to_string(match_mode) + "_3";
+            ofstream output_match_file;
+            output_match_file.open(output_dir + "/" + query.output_prefix+"."+filename_index+".match");
+            output_match_file << "##VCF1:" << ref_vcf_filename << "\n";
+            output_match_file << "##VCF2:" << query.vcf_filename << "\n";
+            output_match_file << "#CHROM\tPOS\tREF\tALT\tVCF1\tVCF2\tPHASE1\tPHASE2\tSCORE\n";
+            for(int i = 0; i < chrom_num; i++){
+                output_match_file << query.match_records_by_chrid[i][match_mode];
+            }
+            output_match_file.close();
+        }
+    }
+    if(write_result_files) output_stat_file.close();
+
+    cout << console_string << flush;
+    output_mutex.unlock();
+
+    for(int i = 0; i < chrom_num; i++){
+        for(int j = 0; j < query_threshold_num; j++){
+            delete query.match_num_by_chrid[i][j];
+            delete query.edit_distance_by_chrid[i][j];
         }
+        delete[] query.match_records_by_chrid[i];
+        delete[] query.match_num_by_chrid[i];
+        delete[] query.edit_distance_by_chrid[i];
+        delete variant_by_chrid[i];
+    }
+    delete[] query.match_records_by_chrid;
+    delete[] query.match_num_by_chrid;
+    delete[] query.edit_distance_by_chrid;
+    delete[] variant_by_chrid;
+    query.match_records_by_chrid = NULL;
+    query.match_num_by_chrid = NULL;
+    query.edit_distance_by_chrid = NULL;
+    query.variant_by_chrid = NULL;
+    return true;
+}
+
+void WholeGenome::DirectMatchQueriesInThread(vector<DirectQuery> * query_list, int worker_index, int worker_num, int query_thread_num){
+    for(int i = worker_index; i < query_list->size(); i += worker_num){
+        query_list->at(i).matched = DirectMatchQuery(query_list->at(i), query_thread_num);
+    }
+}
+
+// queries share the baseline read by ReadDirectRef and are matched at the same time,
+// threads left over when there are fewer queries than threads split chromosomes of a query,
+// returns false if any query can not be read
+bool WholeGenome::DirectMatch(vector<string> query_vcf_list,
+                              vector<string> output_prefix_list,
+                              int score_unit_,
+                              int match_mode_)
+{
+    score_unit_indicator = score_unit_;
+    match_mode_indicator = match_mode_;
+    score_scheme_indicator = 3;
+
+    score_unit_list.clear();
+    if(score_unit_indicator == -1){
+        score_unit_list.push_back(0);
+        score_unit_list.push_back(1);
+    }else{
+        score_unit_list.push_back(score_unit_indicator);
+    }
+
+    vector<DirectQuery> query_list;
+    for(int i = 0; i < query_vcf_list.size(); i++){
+        query_list.push_back(DirectQuery(query_vcf_list[i], output_prefix_list[i], match_mode_indicator));
+    }
+    if(query_list.size() == 0) return true;
+
+    cout << "Baseline VCF: " << ref_vcf_filename << endl;
+    cout << "direct matching " << query_list.size() << " queries..." << endl;
+
+    int worker_num = min(thread_num, (int)query_list.size());
+    int query_thread_num = max(1, thread_num / worker_num);
+    ThreadPool::Shared().ParallelFor(worker_num, [&](int i){
+        DirectMatchQueriesInThread(&query_list, i, worker_num, query_thread_num);
+    });
+
+    score_unit_list.clear();
+    bool matched = true;
+    for(int i = 0; i < query_list.size(); i++){
+        if(!query_list[i].matched) matched = false;
     }
-    output_stat_file.close();
-    dout << "matched variants: " << match_num << endl;
+    return matched;
 }
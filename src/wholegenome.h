@@ -11,9 +11,13 @@
 #include <limits>
 #include <thread>
 #include <set>
+#include <functional>
+#include <mutex>
 
 #include "util.h"
 #include "diploidvariant.h"
+#include "vcfreader.h"
+#include "varmatch.h"
 //#include "tbb/task_scheduler_init.h"
 //#include "tbb/blocked_range.h"
 //#include "tbb/parallel_for.h"
@@ -32,6 +36,91 @@ typedef struct VariantIndicator{
     bool refer;
 }VariantIndicator;
 
+// matching cost of one cluster, collected for the cluster report
+typedef struct ClusterStat{
+    ClusterStat(int cluster_id_ = -1,
+    int chr_id_ = -1,
+    int start_ = 0,
+    int end_ = 0,
+    int variant_num_ = 0) :
+    cluster_id(cluster_id_),
+    chr_id(chr_id_),
+    start(start_),
+    end(end_),
+    variant_num(variant_num_),
+    path_num(0),
+    max_path_list_size(0),
+    seconds(0.0),
+    budget_exceeded(false){}
+
+    int cluster_id;
+    int chr_id;
+    int start; // 0-based, included
+    int end; // 0-based, excluded
+    int variant_num;
+    long long path_num; // paths taken from path list, summed over thresholds and modes
+    int max_path_list_size;
+    double seconds; // SNP-only clusters add their share of the batch, see MatchSnpClusterBatch
+    bool budget_exceeded; // fell back to direct matching
+    chrono::steady_clock::time_point begin;
+}ClusterStat;
+
+// sizes of the results of one thread, so that results added after it can be taken back
+typedef struct MatchResultMark{
+    vector<int> record_num; // by mode_index
+    vector<int> totals; // baseline and query match numbers and edit distances, by threshold and mode_index
+}MatchResultMark;
+
+// a huge cluster matched after all threads finish, its records replace the empty records
+// at record_slot, by mode_index, so they keep their place among the records of the thread
+typedef struct DeferredCluster{
+    int cluster_id;
+    vector<int> record_slot;
+}DeferredCluster;
+
+// per cluster limits of the matching engine, 0 means unlimited
+typedef struct ClusterBudget{
+    ClusterBudget(int max_path_num_ = 0,
+    int max_path_memory_ = 0,
+    double max_seconds_ = 0.0) :
+    max_path_num(max_path_num_),
+    max_path_memory(max_path_memory_),
+    max_seconds(max_seconds_){}
+
+    int max_path_num; // paths kept in path lists
+    int max_path_memory; // MB, estimated from path size
+    double max_seconds;
+}ClusterBudget;
+
+// one query of direct matching, read, matched and released by the thread it is assigned to
+typedef struct DirectQuery{
+    DirectQuery(string vcf_filename_ = "",
+    string output_prefix_ = "",
+    int match_mode_indicator_ = -1) :
+    vcf_filename(vcf_filename_),
+    output_prefix(output_prefix_),
+    match_mode_indicator(match_mode_indicator_),
+    variant_total_num(0),
+    matched(false),
+    variant_by_chrid(NULL),
+    match_records_by_chrid(NULL),
+    match_num_by_chrid(NULL),
+    edit_distance_by_chrid(NULL){}
+
+    string vcf_filename;
+    string output_prefix;
+    int match_mode_indicator;
+    int variant_total_num;
+    bool matched; // read and matched, results are written
+    vector<int> match_mode_list;
+    vector<double> threshold_list;
+    vector<float> per_list;
+    vector<DiploidVariant> ** variant_by_chrid;
+    string ** match_records_by_chrid; // by chr_id and match_mode
+    vector<int> *** match_num_by_chrid; // by chr_id and threshold, then match_mode
+    vector<int> *** edit_distance_by_chrid;
+}DirectQuery;
+
 typedef struct Interval {
     int start;
     int end;
@@ -39,15 +128,138 @@ typedef struct Interval {
     Interval(int s, int e) : start(s), end(e) {}
 }Interval;
 
+// decision points of one cluster, offsets are relative to the cluster subsequence
+typedef struct DecisionIndex{
+    vector<int> first_var_by_offset; // -1 if no variant starts at this offset
+    vector<int> next_var; // next variant starting at the same offset, -1 at the end
+    vector<int> next_decision_offset; // first offset >= current one where a variant starts
+    vector<int> variant_indexes[2]; // variants that can be decided, baseline and query
+}DecisionIndex;
+
+// one cluster, at one threshold, waiting in a SnpClusterBatch
+typedef struct SnpCluster{
+    int threshold_index;
+    int chr_id;
+    bool direct; // a single identical pair, recorded as in MatchVariantListInThread
+    vector<DiploidVariant> variant_list;
+    string subsequence;
+    int offset;
+    int position_start; // positions of the cluster in the batch, [start, end)
+    int position_end;
+    int stat_index; // in SnpClusterBatch::cluster_stats, -1 if not reported
+    vector<vector<int> > best_choices; // by mode, in score_unit, match_mode, score_scheme order
+    vector<int> best_scores;
+}SnpCluster;
+
+// SNP-only clusters of one thread matched together, every variant position of every cluster
+// is a lane of the arrays below, see MatchSnpClusterBatch
+typedef struct SnpClusterBatch{
+    vector<SnpCluster> clusters;
+    vector<ClusterStat> cluster_stats; // for the cluster report, complete once the batch is matched
+    vector<int> var_index[2]; // by position, baseline and query variant in variant_list, -1 if none
+    vector<char> reference_base; // by position
+
+    // choices of baseline (x = 0) and query (x = 1) variants, when haplotypes are still symmetric (s = 1) or not (s = 0)
+    // TableIndex gives the lane of choice c, in the order VariantMakeDecision creates them
+    vector<int> choice_num; // by x, s and position
+    vector<int> choice_value; // by x, s, c and position
+    vector<int> choice_allele[2]; // base on each haplotype, by x, s, c and position
+    vector<int> choice_score;
+    vector<int> choice_keeps_symmetry;
+
+    // best pair of choices on each position, by s and position
+    vector<int> best_choice[2];
+    vector<int> best_score;
+    vector<int> next_symmetric;
+
+    int position_num() const {
+        return reference_base.size();
+    }
+    int TableIndex(int x, int s, int c, int p) const {
+        return ((x * 2 + s) * MAX_CHOICE_NUM + c) * position_num() + p;
+    }
+
+    const static int MAX_CHOICE_NUM = 5;
+    const static int MAX_CLUSTER_NUM = 1024;
+}SnpClusterBatch;
+
+// choices of a path packed in 3 bits per variant, undecided variants read as UNDECIDED
+// choices of clusters up to INLINE_WORD_NUM*CHOICE_PER_WORD variants are stored inline
+class ChoiceVector{
+public:
+    // besides these, a choice is -2, -1, 0 or 1, see WholeGenome::VariantMakeDecision
+    const static int UNDECIDED = -89;
+    const static int NOT_USE = -9;
+
+    ChoiceVector(int n = 0) : choice_num(n)
+    {
+        for(int i = 0; i < INLINE_WORD_NUM; i++){
+            inline_words[i] = 0;
+        }
+        int word_num = (n + CHOICE_PER_WORD - 1) / CHOICE_PER_WORD;
+        if(word_num > INLINE_WORD_NUM) heap_words.resize(word_num, 0);
+    }
+
+    int operator[](int i) const {
+        int code = (Word(i) >> Shift(i)) & 7;
+        return ChoiceFromCode(code);
+    }
+
+    void set(int i, int c){
+        unsigned long long code = CodeFromChoice(c);
+        unsigned long long & word = Word(i);
+        word = (word & ~(7ULL << Shift(i))) | (code << Shift(i));
+    }
+
+    int size() const {
+        return choice_num;
+    }
+
+    long long HeapMemory() const {
+        return heap_words.size() * sizeof(unsigned long long);
+    }
+
+private:
+    const static int CHOICE_PER_WORD = 21;
+    const static int INLINE_WORD_NUM = 4;
+    int choice_num;
+    unsigned long long inline_words[INLINE_WORD_NUM];
+    vector<unsigned long long> heap_words;
+
+    // code 0 is undecided, then NOT_USE, -2, -1, 0, 1
+    static int ChoiceFromCode(int code){
+        static const int choice_by_code[6] = {UNDECIDED, NOT_USE, -2, -1, 0, 1};
+        return choice_by_code[code];
+    }
+    static int CodeFromChoice(int c){
+        if(c == NOT_USE) return 1;
+        if(c >= -2 && c <= 1) return c + 4;
+        return 0;
+    }
+
+    int Shift(int i) const {
+        return (i % CHOICE_PER_WORD) * 3;
+    }
+    unsigned long long & Word(int i){
+        if(heap_words.empty()) return inline_words[i / CHOICE_PER_WORD];
+        return heap_words[i / CHOICE_PER_WORD];
+    }
+    const unsigned long long & Word(int i) const {
+        if(heap_words.empty()) return inline_words[i / CHOICE_PER_WORD];
+        return heap_words[i / CHOICE_PER_WORD];
+    }
+};
+
 class SequencePath{
 public:
-    SequencePath(int n, int v)
+    SequencePath(int n, int v) : choice_vector(v)
     {
         reference_length = n;
         for(int i = 0; i < 4; i++){
             string_sequences[i].resize(n, ".");
             // default value is "."
             donor_sequences[i] = "";
+            donor_hash[i] = 0;
         }
         current_genome_pos = -1;
         score = 0;
@@ -55,26 +267,106 @@ public:
         same_donor_len = false;
         current_equal_donor_pos[0] = -1;
         current_equal_donor_pos[1] = -1;
+        donor_skipped[0] = 0;
+        donor_skipped[1] = 0;
         reached_sync_num = 0;
-
-        for(int i = 0; i < v; i++){
-            choice_vector.push_back(-89);
+        for(int i = 0; i < 4; i++){
+            length_change[i] = 0;
+        }
+        for(int i = 0; i < 2; i++){
+            undecided_mil[i] = 0;
+            undecided_mdl[i] = 0;
         }
+        phasing_symmetric = false;
+        frontier_index = 0;
+        decision_num = 0;
     }
     int reference_length;
     vector<string> string_sequences[4];
-    map<int, pair<int, int>> choice_made[2]; // this can be used to indicate if choice is made and which choice
-    // one choice is a pair: variant id, phasing index
     int current_genome_pos;
     string donor_sequences[4];
+    unsigned long long donor_hash[4]; // polynomial hash of donor_sequences, modulo 2^64
     int current_equal_donor_pos[2];
+    int donor_skipped[2]; // shared bases left out of truth and query donors of each haplotype
     int score;
     bool removable;
     bool same_donor_len;
     int reached_sync_num;
-    vector<int> choice_vector;
+    ChoiceVector choice_vector;
+    int length_change[4]; // donor length minus reference length, including decided but not extended changes
+    int undecided_mil[2]; // truth and query
+    int undecided_mdl[2];
+    bool phasing_symmetric; // both haplotypes of truth and query are identical, mirror choices can be skipped
+    int frontier_index; // position in the path list at the last sync point, see ExtendPathsInParallel
+    int decision_num; // decisions made since the last sync point
+
+    int DonorLength(int index){
+        return donor_sequences[index].length() + donor_skipped[index%2];
+    }
+
+    // keep length_change in step with string_sequences, "." stands for one reference base
+    void SetSequence(int index, int pos, const string & s){
+        string & current = string_sequences[index][pos];
+        int current_length = 1;
+        if(current != ".") current_length = current.length();
+        length_change[index] += (int)s.length() - current_length;
+        current = s;
+    }
+
+    void AppendSequence(int index, int pos, const string & s){
+        string_sequences[index][pos] += s;
+        length_change[index] += s.length();
+    }
+};
+
+// paths reaching the same sync point with the same donor lengths are interchangeable,
+// so only the one with highest score needs to be extended
+typedef struct ConvergeKey{
+    int genome_pos;
+    int donor_length[4]; // truth pair and query pair, each pair sorted
+
+    bool operator ==(const ConvergeKey & y) const {
+        return genome_pos == y.genome_pos &&
+            donor_length[0] == y.donor_length[0] &&
+            donor_length[1] == y.donor_length[1] &&
+            donor_length[2] == y.donor_length[2] &&
+            donor_length[3] == y.donor_length[3];
+    }
+}ConvergeKey;
+
+struct ConvergeKeyHash{
+    size_t operator()(const ConvergeKey & key) const {
+        size_t result = std::hash<int>()(key.genome_pos);
+        for(int i = 0; i < 4; i++){
+            result = result * 1000003 ^ std::hash<int>()(key.donor_length[i]);
+        }
+        return result;
+    }
 };
 
+ConvergeKey GetConvergeKey(SequencePath & sp);
+
+// node of best-first search on paths
+// bound is path score plus the highest score that undecided variants can add
+typedef struct SearchNode{
+    SearchNode(int bound_,
+    int remaining_,
+    bool complete_,
+    long long order_,
+    SequencePath path_) :
+    bound(bound_),
+    remaining(remaining_),
+    complete(complete_),
+    order(order_),
+    path(move(path_)){}
+
+    int bound;
+    int remaining;
+    bool complete; // path reached the end of cluster
+    long long order; // first in, first out when bounds are equal
+    SequencePath path;
+}SearchNode;
+
 class WholeGenome{
 private:
     int chrom_num;
@@ -112,6 +404,10 @@ protected:
     vector<int> *** baseline_total_edit_distance;
     vector<int> *** query_total_edit_distance;
 
+    // direct matching, baseline is shared by queries matched at the same time
+    bool direct_match;
+    mutex output_mutex;
+
     //map<float, int> *** tp_qual_num_by_mode_by_thread;
     //map<float, int> *** fp_qual_num_by_mode_by_thread;
 
@@ -135,9 +431,79 @@ protected:
 
     vector<float> per_list;
 
+    // cluster report
+    bool cluster_report;
+    int report_top_num;
+    map<int, int> cluster_size_num;
+    map<int, int> cluster_size_chrid;
+    vector<ClusterStat> ** cluster_stats_by_thread;
+
+    ClusterBudget cluster_budget;
+    ClusterStat * current_cluster_stat_by_thread;
+    vector<ClusterStat> ** budget_exceeded_clusters_by_thread;
+
+    bool best_first_search;
+
+    // clusters with more variants are matched after all others, expanding paths on all threads
+    int parallel_cluster_size;
+    vector<DeferredCluster> ** deferred_clusters_by_thread;
+    bool expand_paths_in_parallel;
+
+    // split clusters at gaps where every matching is in sync
+    bool split_clusters;
+    vector<int> largest_cluster_before_split_by_chrid;
+    vector<int> split_cluster_num_by_chrid;
+    int largest_cluster_before_split;
+    int split_cluster_num;
+
+    // confident regions by chromosome name, sorted and merged
+    map<string, vector<Interval> > bed_regions_by_chrname;
+    bool InBedRegions(const string & chr_name, int pos);
+
+    // this run matches shard shard_index of shard_num, see ShardClusterRange
+    int shard_index;
+    int shard_num;
+    void ShardClusterRange(int & start, int & end);
+
+    // regions given with --region, only these are read
+    vector<GenomeRegion> target_regions;
+    map<string, vector<Interval> > target_regions_by_chrname;
+    bool InTargetRegions(const string & chr_name, int pos);
+    bool ReadGenomeRegions(string filename);
+
+    // identical variant pairs matched before clustering, by chromosome and threshold
+    bool exact_prepass;
+    vector<vector<string> > exact_match_records_by_chrid;
+    vector<vector<int> > exact_match_num_by_chrid;
+    vector<vector<int> > exact_edit_distance_by_chrid;
+
+    // results given to library callers, files are not written when write_result_files is false
+    MatchRecordCallback match_record_callback;
+    MatchStatCallback match_stat_callback;
+    bool write_result_files;
+    VarMatchStat NewMatchStat(int score_unit, int match_mode, int score_scheme, int query_total_num);
+    void ReportMatchRecords(int score_unit, int match_mode, int score_scheme, const string & match_records);
+
+    // query lines held in memory, read instead of the query file when not NULL
+    const vector<string> * query_lines;
+
+    // copies of the genome for NUMA nodes 1 and up, node 0 reads genome_sequences
+    bool numa_replicas;
+    vector<map<int, string> *> genome_replicas;
+    void ReplicateGenome();
+    const string & GenomeSequence(int chr_id);
+
     bool ReadWholeGenomeSequence(string filename);
     bool ReadGenomeSequenceList(string filename);
     int ReadWholeGenomeVariant(string filename, bool flag);
+    int ReadWholeGenomeVariant(string filename,
+                               bool flag,
+                               vector<DiploidVariant> ** variant_by_chrid,
+                               int & match_mode_indicator,
+                               vector<double> & threshold_list,
+                               vector<float> & per_list,
+                               vector<string> * variant_strings);
+    bool ReadChromosomeNames(string filename);
     bool ReadVariantFileList(string filename);
     int ReadReferenceVariants(string filename);
     int ReadQueryVariants(string filename);
@@ -146,11 +512,25 @@ protected:
     bool TBBMatching();
 
     void SingleThreadClustering(int chr_id);
+    bool GapHasPeriod(const string & sequence, int start, int length, int max_period);
+    void SplitClustersAtSyncGaps(int chr_id);
+    void ExactMatchPrepass(int chr_id, vector<bool> & ref_exact_matched, vector<bool> & que_exact_matched);
+    bool PassSameThresholds(double qual, double other_qual);
     //bool MatchingSingleCluster(int cluster_index, int thread_index, int match_mode);
 
     //override
     bool ClusteringMatchInThread(int start, int end, int thread_index);
+    bool MatchClusterInThread(int cluster_id, int thread_index, SnpClusterBatch * snp_batch = NULL);
+    void MatchClusterThresholds(vector<VariantIndicator> & vi_list, int cluster_id, int thread_index, SnpClusterBatch * snp_batch);
+    void DeferCluster(int cluster_id, int thread_index);
+    void MatchDeferredCluster(DeferredCluster & deferred_cluster, int thread_index);
+    void MarkMatchResults(int thread_index, MatchResultMark & mark);
+    void RestoreMatchResults(int thread_index, MatchResultMark & mark);
+    void AllocateMatchResults();
+    void AddExactMatchResults();
+    void ReleaseMatchResults();
     void ClusteringMatchMultiThread();
+    void OutputClusterReport();
     int NormalizeVariantSequence(int pos,
                              string & parsimonious_ref,
                              string & parsimonious_alt0,
@@ -175,22 +555,25 @@ protected:
         return results;
     }
 
-    int PathNeedDecision(SequencePath& sp, multimap<int, int> * choices_by_pos[], int pos);
+    int PathNeedDecision(SequencePath& sp, DecisionIndex & decision_index, int pos);
+    void BuildDecisionIndex(DecisionIndex & decision_index,
+                            vector<DiploidVariant> & variant_list,
+                            vector<bool> & appliable_flag,
+                            int offset,
+                            int subsequence_length);
+    void ExtendDonorSequences(SequencePath & sp,
+                              const string & reference_sequence,
+                              int start_pos,
+                              int end_pos,
+                              int match_mode);
+    void RebuildDonorSequences(SequencePath & sp, const string & reference_sequence);
     int PathExtendOneStep(SequencePath& sp,
-                          multimap<int, int> * choices_by_pos[],
+                          DecisionIndex & decision_index,
                           const string & reference_sequence,
                           vector<int> & sync_points,
                           int match_mode,
                           int & variant_need_decision);
 
-    bool PathMakeDecision(SequencePath& sp,
-                                 vector<DiploidVariant> & variant_list,
-                                 multimap<int, int> * choices_by_pos[],
-                                 list<SequencePath> & sequence_path_list,
-                                 const string & reference_sequence,
-                                 int score_unit,
-                                 int match_mode,
-                                 int score_scheme);
 
     bool VariantMakeDecision(SequencePath& sp,
                              vector<DiploidVariant> & variant_list,
@@ -210,6 +593,14 @@ protected:
                          int score_scheme,
                          int variant_index);
 
+    void InitializeLengthBalance(SequencePath & sp,
+                                 vector<DiploidVariant> & variant_list,
+                                 DecisionIndex & decision_index);
+    bool PathLengthBalanced(SequencePath & sp, int match_mode);
+    bool MirrorChoicesEquivalent(vector<DiploidVariant> & variant_list,
+                                 int score_unit,
+                                 int match_mode);
+
     bool AppendChangedSp(SequencePath& sp,
                          vector<DiploidVariant> & variant_list,
                          list<SequencePath> & sequence_path_list,
@@ -230,42 +621,122 @@ protected:
                          int variant_index,
                          int c);
 
-    bool PathMakeDecisionBackup(SequencePath& sp,
-                                 vector<DiploidVariant> & variant_list,
-                                 multimap<int, int> * choices_by_pos[],
-                                 list<SequencePath> & sequence_path_list,
-                                 const string & reference_sequence,
-                                 int score_unit,
-                                 int match_mode,
-                                 int score_scheme);
+
+    bool ExtendPathsToSyncPoint(int thread_index,
+                                int worker_num,
+                                list<SequencePath> & current_path_list,
+                                list<SequencePath> & next_path_list,
+                                SequencePath & best_path,
+                                vector<DiploidVariant> & variant_list,
+                                string & subsequence,
+                                DecisionIndex & decision_index,
+                                vector<int> & sync_points,
+                                int score_unit,
+                                int match_mode,
+                                int score_scheme,
+                                long long & path_num,
+                                int & max_path_list_size,
+                                long long & path_memory);
+
+    bool ExtendPathsInParallel(int thread_index,
+                               list<SequencePath> & current_path_list,
+                               list<SequencePath> & next_path_list,
+                               SequencePath & best_path,
+                               vector<DiploidVariant> & variant_list,
+                               string & subsequence,
+                               DecisionIndex & decision_index,
+                               vector<int> & sync_points,
+                               int score_unit,
+                               int match_mode,
+                               int score_scheme,
+                               long long & path_num,
+                               int & max_path_list_size,
+                               long long & path_memory);
+
+    bool IsSnpCluster(vector<DiploidVariant> & variant_list);
+
+    void SnpVariantChoices(DiploidVariant & var,
+                           bool phasing_symmetric,
+                           int match_mode,
+                           vector<int> & choices);
+
+    void SnpChoiceAltIndexes(DiploidVariant & var,
+                             int c,
+                             int match_mode,
+                             int alt_indexes[]);
+
+    bool IsSnpCluster(vector<VariantIndicator> & vi_list);
+
+    void AddSnpCluster(SnpClusterBatch & batch,
+                       int threshold_index,
+                       int chr_id,
+                       vector<DiploidVariant> & variant_list,
+                       string & subsequence,
+                       int offset);
+
+    void FillSnpChoiceTable(SnpClusterBatch & batch,
+                            int score_unit,
+                            int match_mode,
+                            int score_scheme);
+
+    void MatchSnpPositions(SnpClusterBatch & batch);
+
+    void MatchSnpClusterBatch(int thread_index, SnpClusterBatch & batch);
+
+    void AddDirectMatchRecord(int thread_index,
+                              int threshold_index,
+                              int chr_id,
+                              DiploidVariant & tv);
 
     bool MatchingSingleClusterBaseExtending(int cluster_index,
                                             int thread_index,
                                             vector<DiploidVariant> & variant_list,
                                             string & subsequence,
                                             int offset,
-                                            multimap<int, int> * choices_by_pos[],
+                                            DecisionIndex & decision_index,
                                             vector<int> & sync_points,
                                             int chr_id,
                                             int score_unit,
                                             int match_mode,
                                             int score_scheme,
-                                            int threshold_index);
+                                            int threshold_index,
+                                            bool & budget_exceeded);
+
+    bool MatchingSingleClusterBestFirst(int cluster_index,
+                                        int thread_index,
+                                        vector<DiploidVariant> & variant_list,
+                                        string & subsequence,
+                                        int offset,
+                                        DecisionIndex & decision_index,
+                                        vector<int> & sync_points,
+                                        int chr_id,
+                                        int score_unit,
+                                        int match_mode,
+                                        int score_scheme,
+                                        int threshold_index,
+                                        bool & budget_exceeded);
+
+    int MaxVariantScore(DiploidVariant & dv,
+                        int score_unit,
+                        int match_mode,
+                        int score_scheme);
+
+    long long PathMemory(SequencePath & sp);
+    bool ClusterBudgetExceeded(int thread_index, int path_list_size, long long path_memory);
+    void DirectMatchVariantList(int thread_index,
+                                int threshold_index,
+                                int chr_id,
+                                vector<DiploidVariant> & variant_list,
+                                int match_mode,
+                                int mode_index);
 
-    bool DonorLengthEqual(SequencePath & a, SequencePath & b);
     void ConvergePaths(list<SequencePath> & path_list);
     int CheckPathEqualProperty(SequencePath & sp, int match_mode);
+    bool DonorPairEqual(SequencePath & sp, int y);
+    void DropEqualDonorPrefix(SequencePath & sp, int y);
 
     int ScoreEditDistance(DiploidVariant & dv, int allele_indicator);
     int EditDistance(const std::string& s1, const std::string& s2);
-    bool PathMakeDecisionNoGenotype(SequencePath& sp,
-                                 vector<DiploidVariant> & variant_list,
-                                 multimap<int, int> * choices_by_pos[],
-                                 list<SequencePath> & sequence_path_list,
-                                 const string & reference_sequence,
-                                 int score_unit,
-                                 int match_mode,
-                                 int score_scheme);
 
     void ConstructMatchRecord(SequencePath & best_path,
                                vector<DiploidVariant> & variant_list,
@@ -276,14 +747,6 @@ protected:
                                int mode_index,
                                int threshold_index);
 
-    void ConstructMatchRecordBackup(SequencePath & best_path,
-                               vector<DiploidVariant> & variant_list,
-                               string & subsequence,
-                               int offset,
-                               int thread_index,
-                               int chr_id,
-                               int mode_index,
-                               int threshold_index);
 
     void ConstructMatchRecordNoGenotype(SequencePath & best_path,
                                        vector<DiploidVariant> & variant_list,
@@ -294,14 +757,6 @@ protected:
                                        int mode_index,
                                        int threshold_index);
 
-    void ConstructMatchRecordNoGenotypeBackup(SequencePath & best_path,
-                                       vector<DiploidVariant> & variant_list,
-                                       string & subsequence,
-                                       int offset,
-                                       int thread_index,
-                                       int chr_id,
-                                       int mode_index,
-                                       int threshold_index);
 
     int CalculateScore(DiploidVariant & dv,
                        int choice,
@@ -322,11 +777,13 @@ protected:
         int threshold_index,
         int chr_id,
         vector<DiploidVariant> & variant_list,
-        int cluster_id);
+        int cluster_id,
+        SnpClusterBatch * snp_batch = NULL);
 
     void initialize_score_matrix(int **score, char **trackBack, int M, int N);
     int needleman_wunsch(string S1, string S2, string &R1, string &R2);
     void GenerateAltVector(string ref, string alt, vector<string> & alt_vector);
+    void CompileAltVectors(DiploidVariant & dv);
 
     int CalculateEditDistance(DiploidVariant & dv,
                                 int choice,
@@ -335,26 +792,60 @@ protected:
 public:
     WholeGenome(int thread_num_,
                 string output_dir_,
-                bool pr_curves_);
+                bool pr_curves_,
+                bool cluster_report_ = false,
+                int report_top_num_ = 10,
+                ClusterBudget cluster_budget_ = ClusterBudget(),
+                bool best_first_search_ = false,
+                int parallel_cluster_size_ = 0,
+                bool split_clusters_ = false,
+                bool exact_prepass_ = false);
 
     ~WholeGenome();
 
-    void ReadRef(string genome_seq, 
+    bool ReadRef(string genome_seq, 
       string ref_vcf);
 
-    void ReadDirectRef(string genome_seq, string ref_vcf);
+    bool ReadDirectRef(string genome_seq, string ref_vcf);
+
+    bool ReadBedRegions(string filename);
 
-    void Compare(string query_vcf,
+    bool SetTargetRegions(vector<string> region_strings, string region_filename);
+
+    bool SetShard(int shard_index_, int shard_num_);
+
+    void SetResultCallbacks(MatchRecordCallback record_callback,
+                            MatchStatCallback stat_callback,
+                            bool write_result_files_);
+
+    void SetQueryLines(const vector<string> * lines);
+
+    void SetOutputDir(string output_dir_);
+
+    void SetNumaReplicas(bool numa_replicas_);
+
+    bool Compare(string query_vcf,
         string output_prefix,
         bool detail_results,
         int score_unit_,
         int match_mode_,
         int score_scheme_);
 
-    void DirectMatch(string ref_vcf,
-                string query_vcf,
-                int match_mode_,
-                string output_prefix);
+    bool DirectMatch(vector<string> query_vcf_list,
+                     vector<string> output_prefix_list,
+                     int score_unit_,
+                     int match_mode_);
+
+    bool DirectMatchQuery(DirectQuery & query, int query_thread_num);
+
+    void DirectMatchQueriesInThread(vector<DirectQuery> * query_list,
+                                    int worker_index,
+                                    int worker_num,
+                                    int query_thread_num);
+
+    void DirectMatchChromosome(DirectQuery & query, int chr_id);
+
+    void DirectMatchChromosomesInThread(DirectQuery * query, int thread_index, int query_thread_num);
 
     int test(); // for direct test
     void PrintPath(SequencePath & sp);
@@ -363,7 +854,13 @@ public:
     const static int VAR_LEN = 100;
     const static int MAX_REPEAT_LEN = 1000;
     const static int ROC_SAMPLE_NUM = 5;
-    const static int MEANING_CHOICE_BOUND = -10;
-    const static int NOT_USE = -9;
+    const static int MEANING_CHOICE_BOUND = -10; // choices above it are decided, ChoiceVector::UNDECIDED is below
+    const static int NOT_USE = ChoiceVector::NOT_USE;
     const static int EASY_MATCH_VAR_NUM = 5;
+    const static unsigned long long DONOR_HASH_BASE = 1000003;
+    const static int REGION_PADDING = 10000;
 };
+
+// PathNeedDecision relies on undecided choices being below the bound and NOT_USE above it
+static_assert(ChoiceVector::UNDECIDED <= WholeGenome::MEANING_CHOICE_BOUND &&
+              WholeGenome::MEANING_CHOICE_BOUND < ChoiceVector::NOT_USE, "choice encoding out of order");